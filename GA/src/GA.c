@@ -13,189 +13,4511 @@
    Author: Gonzalo S Nido <insectopalo@gmail.com>
 */
 
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef GA_MPI
+#include <mpi.h>
+#endif
+#include "ga.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GA_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/*
+   The genomes are stored packed, 64 genes per machine word. Gene j lives in
+   bit (j % 64) of word (j / 64); the unused high bits of the last word are
+   always kept to zero so that counting ones never needs a mask.
+   - ALIGN_BYTES is the alignment of every genome row in memory. Rows are
+     padded to a whole number of cache lines, which is also enough for any
+     SIMD load
+*/
+typedef uint64_t word_t;
+#define WORD_BITS 64
+#define ALIGN_BYTES 64
+#define ALIGN_WORDS (ALIGN_BYTES / sizeof(word_t))
+
+/*
+   Definition of the parameters used in the simulation. They are read from the
+   command line by read_config(), see usage() for the flags.
+   - g_size (n) is the length in bits of each computer word.
+   - p_size (m) is the number of words in the population
+   - bottleneck (b) is the number of genomes that survive each generation
+     giving rise to the progeny by crossover
+   - offspring is the number of new words bred every generation (b by
+     default). They replace the least fit words, and the p_size - offspring
+     fittest ones are carried over to the next generation unchanged
+   - max_generations (bmax) is the maximum number of generations in the
+     simulation
+   - verbose, when set to 1, prints every comparison made while sorting the
+     population (debugging only, it is very slow for big populations). Only
+     Quicksort compares, so it needs counting_sort and partition set to 0
+     and truncation selection
+   - counting_sort, when set to 1, ranks the population with a counting sort
+     over the g_size+1 possible fitness values instead of Quicksort
+   - partition, when set to 1, does not sort the population at all: it is only
+     split around the bottleneck cuts, which is all the selection needs
+   - seed is the seed of the random number generator. Two runs with the same
+     seed and parameters give the same result
+   - threads is the number of threads the generation loops are split across
+     (only when compiled with OpenMP, -fopenmp). Every thread draws from its
+     own stream of the generator and always gets the same share of each loop,
+     so the result depends on the seed and the number of threads only
+   - islands is the number of independent populations of p_size words each,
+     every one of them evolving on its own thread. Every migration_interval
+     generations the best "migrants" words of each island replace the worst
+     ones of the next island in a ring. With islands > 1 each island runs its
+     own loops on a single thread
+   - crossover_type is the crossover operator: one point (the original one),
+     two points or uniform, see the CROSSOVER_ constants
+   - obj is the fitness function, chosen by name from the "objectives" table
+   - incremental, when set to 1, computes the fitness of the offspring from
+     the fitness of their parents and the genes the operators changed,
+     without scanning the new genomes. Only used when the fitness function
+     supports it
+   - selection is the way the parents are chosen, see the SELECTION_
+     constants: truncation (the original one) pairs the bottleneck fittest
+     words at random, tournament takes the fittest of tournament_size words
+     drawn at random for each parent, and roulette draws each parent with a
+     probability proportional to its fitness. Neither of the last two needs
+     the population sorted, nor uses the bottleneck
+   - steady_state, when set to 1, runs the steady-state GA instead of the
+     generational one: two offspring are bred at a time and replace the two
+     least fit words at once, so that they can be chosen as parents by the
+     next pair (see steady_generation()). A generation is then "offspring"
+     births. Truncation picks the parents uniformly at random, the selection
+     pressure coming from the replacement of the worst, and roulette is not
+     supported
+   - async, when set to 1, runs the steady state asynchronously: the
+     offspring are evaluated by threads - 1 other threads as the first one
+     breeds them (see async_generation()), for expensive fitness functions.
+     It implies steady_state
+   - mutation_rate is the probability of every gene of an offspring to be
+     flipped after the crossover (0 by default, no mutation)
+   - target, stagnation and time_limit are the stop criteria besides
+     max_generations: the run stops as soon as the best word reaches a
+     fitness of "target" (1 by default), when the best fitness has not
+     improved for "stagnation" generations, or when "time_limit" seconds have
+     passed since the start. A value of 0 disables the last two
+   - min_diversity stops the run when the diversity of the population (see
+     population_diversity()) falls below it, the population having
+     converged; with islands, when it falls below it on every island
+     (0 by default, never)
+   - checkpoint is the file where the state of the run is saved every
+     checkpoint_every generations (NULL, the default, saves nothing), and
+     resume the checkpoint to start the run from, instead of a random
+     population. Only for a single population, not for islands
+   - stats is the file where the statistics of every generation are written
+     as CSV (NULL, the default, writes none; "-" is the standard output),
+     dump the file where the final population is written in hexadecimal, and
+     quiet, when set to 1, does not print the populations nor the best
+     fitness of every generation. Statistics are only written for a single
+     population
+   - profile, when set to 1, times every phase of the generation loop and
+     prints the breakdown at the end, and benchmark, when set to 1, runs the
+     benchmark grid of run_benchmark() instead of a normal run
+   - kernels is the name of the kernel set to use, or NULL to use the best
+     one the processor supports
+   - sweep is the parameter grid of a sweep (see run_sweep()), or NULL for a
+     normal run, and sweep_out the file where its results are written
+   - memo_size is the number of scores kept by the fitness memo (0, the
+     default, keeps none), and memo the memo itself, opened by main() when
+     memo_size > 0 and shared by every population of the run
+   The last five fields are derived from the others: target_score is the
+   score matching a fitness of "target" (rounded up to an integer when the
+   scores are integers), mutation_log is log(1 - mutation_rate), used to draw
+   the gaps between mutations, alleles is set when the allele counters of
+   the population are kept (for the statistics or min_diversity), g_words
+   is the number of words needed to store g_size genes, and stride is the
+   number of words between two consecutive rows of the population (g_words
+   rounded up to ALIGN_WORDS)
+*/
+enum { CROSSOVER_ONE_POINT = GA_CROSSOVER_ONE_POINT,
+       CROSSOVER_TWO_POINT = GA_CROSSOVER_TWO_POINT,
+       CROSSOVER_UNIFORM = GA_CROSSOVER_UNIFORM };
+enum { SELECTION_TRUNCATION = GA_SELECTION_TRUNCATION,
+       SELECTION_TOURNAMENT = GA_SELECTION_TOURNAMENT,
+       SELECTION_ROULETTE = GA_SELECTION_ROULETTE };
+
+typedef struct objective objective;
+typedef struct memo_table memo_table;
+
+typedef struct {
+   int g_size;
+   int p_size;
+   int bottleneck;
+   int offspring;
+   int max_generations;
+   int verbose;
+   int counting_sort;
+   int partition;
+   uint64_t seed;
+   int threads;
+   int islands;
+   int migration_interval;
+   int migrants;
+   int crossover_type;
+   const objective * obj;
+   int incremental;
+   int selection;
+   int tournament_size;
+   int steady_state;
+   int async;
+   double mutation_rate;
+   double target;
+   int stagnation;
+   double time_limit;
+   double min_diversity;
+   const char * checkpoint;
+   int checkpoint_every;
+   const char * resume;
+   const char * stats;
+   const char * dump;
+   int quiet;
+   int profile;
+   int benchmark;
+   const char * kernels;
+   const char * sweep;
+   const char * sweep_out;
+   int memo_size;
+   memo_table * memo;
+   float target_score;
+   double mutation_log;
+   int alleles;
+   int g_words;
+   int stride;
+} config;
+
+/*
+   A fitness function. "eval" computes the score of a batch of n genomes
+   stored c->stride words apart starting at "genomes", writing them to out[0]
+   to out[n-1]; it is always called with as many genomes as possible at once,
+   so that an expensive objective can amortize its setup and vectorize across
+   organisms. Higher scores are fitter, and max_score is the score of a
+   perfect word. When levels > 0 the scores are the integers 0..levels, which
+   lets the population be ranked with a counting sort. "incremental" is set
+   by additive objectives whose score is the number of ones, so that the
+   score of an offspring is the score of its parent plus the change in ones
+   reported by the genetic operators. "data" is free for the objective to use
+*/
+struct objective {
+   const char * name;
+   void (*eval)(const objective * o, const config * c, const word_t * genomes,
+                int n, float * out);
+   float max_score;
+   int levels;
+   int incremental;
+   void * data;
+};
+
+/*
+   Sorting key: the cached fitness of a row and the row itself
+*/
+typedef struct {
+   float score;
+   int row;
+} fkey;
+
+/*
+   Entry of the alias table of the roulette selection (Walker's alias method):
+   slot i is chosen with probability "prob", and "alias" otherwise
+*/
+typedef struct {
+   float prob;
+   int alias;
+} alias_t;
+
+/*
+   Indexed binary heap of the rows of a population over their cached scores,
+   for the steady-state GA: rows[0] is the fittest row when "max" is set and
+   the least fit one otherwise, with the ties broken as fitter() does, and
+   pos[row] is the position of "row" in "rows", so a row whose score changes
+   is moved to its place in O(log n)
+*/
+typedef struct {
+   int * rows;
+   int * pos;
+   int n;
+   int max;
+} heap;
+
+/*
+   Cell and ends of the lock-free queue of the asynchronous steady state
+   (see mpmc_push()), the ends on cache lines of their own
+*/
+typedef struct {
+   atomic_size_t seq;
+   int value;
+} mpmc_cell;
+
+typedef struct {
+   mpmc_cell * cells;
+   size_t mask;
+   _Alignas(ALIGN_BYTES) atomic_size_t head;
+   _Alignas(ALIGN_BYTES) atomic_size_t tail;
+} mpmc_queue;
+
+/*
+   Timers of the phases of a run, for profile and benchmark. wall_time returns
+   the time in seconds of a monotonic clock. phase_start returns the time
+   when the phases are timed (0 otherwise), and phase_end adds the time
+   elapsed since "start" to the given phase, returning the current time to
+   chain it to the next phase
+*/
+enum { PHASE_INIT, PHASE_EVALUATE, PHASE_RANK, PHASE_SELECT, PHASE_BREED,
+       N_PHASES };
+
+static const char * phase_names[] = {
+   "init", "evaluate", "rank", "select", "breed"
+};
+
+double wall_time(void){
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static inline double phase_start(const config * c){
+   return c->profile ? wall_time() : 0;
+}
+
+/*
+   A run-scoped arena: one block of memory mapped once, from which all the
+   buffers of a population are carved with a bump pointer, each one aligned
+   to ALIGN_BYTES. Blocks of at least HUGE_PAGE_BYTES are aligned to a huge
+   page and advised to use them, and every page is touched when the arena is
+   created, so that no page fault happens inside the generation loop.
+   Everything allocated after arena_mark() is scratch that only lasts one
+   generation: arena_reset() takes the bump pointer back to the mark
+*/
+#define HUGE_PAGE_BYTES ((size_t) 2 << 20)
+#define SMALL_PAGE_BYTES ((size_t) 4096)
+
+typedef struct {
+   char * base;
+   size_t size;
+   size_t used;
+   size_t mark;
+} arena;
+
+/*
+   The population. All the genomes live in a single aligned block of
+   p_size * stride words and never move once written: each row keeps its
+   cached score in "score", and the ranking by fitness is kept apart in
+   "order" (order[0] is the row of the fittest organism, order[p_size-1] the
+   row of the least fit). The cache is filled by the evaluate functions and
+   has to be refreshed whenever a genome changes. "best" is the row of the
+   fittest organism, kept up to date by the functions that write the scores
+   so that it is known without ranking or scanning the population.
+   The population is double buffered: next_generation only reads the current
+   generation from "genome" and "score" and writes the next one into "next"
+   and "next_score", after which both pairs of pointers are swapped.
+   "keys" and "buckets" are scratch space for the ranking, and "parents" and
+   "alias" the buffers of the selection, which only last one generation and
+   share the scratch of the arena. "alleles" holds, for every gene, the
+   number of words carrying a one there (g_words * WORD_BITS counters, those
+   of the padding always 0), kept up to date from one generation to the next
+   when c->alleles is set. "worst" and "fittest" are the heaps of the
+   steady-state GA (only allocated with c->steady_state), whose tops are the
+   least fit and the fittest row. Everything lives in the arena "mem",
+   allocated once with the population, and "phase" holds the seconds spent
+   in every phase when they are timed
+*/
+typedef struct {
+   word_t * genome;
+   float * score;
+   word_t * next;
+   float * next_score;
+   int * order;
+   int best;
+   fkey * keys;
+   int * buckets;
+   int * parents;
+   alias_t * alias;
+   int * alleles;
+   heap worst;
+   heap fittest;
+   double phase[N_PHASES];
+   arena mem;
+} population;
+
+static inline double phase_end(const config * c, population * p, int phase,
+                               double start){
+   if (!c->profile){
+      return 0;
+   }
+   double now = wall_time();
+   p->phase[phase] += now - start;
+   return now;
+}
+
+/*
+   State of the random number generator, xoshiro256** by Blackman and Vigna.
+   It is small and fast, and any number of independent streams can be cut
+   from one seed with rng_jump(), one per thread. The rest of the program only
+   draws numbers through rng_next() and rng_below(), so another generator can
+   be plugged in by rewriting these few functions
+*/
+typedef struct {
+   uint64_t s[4];
+} rng_t;
+
+/* Set from the configuration, used by "comp" which cannot take arguments */
+static int verbose = 0;
+
+/*
+   The rank of this process and the number of ranks, when the island model
+   runs over MPI (compiled with -DGA_MPI and started with mpirun), and 0 and
+   1 otherwise
+*/
+static int mpi_rank = 0;
+static int mpi_ranks = 1;
+
+
+/*
+   Functions of the random number generator. rng_seed expands a 64 bits seed
+   into the full state with splitmix64, rng_next returns 64 random bits,
+   rng_unit returns a double uniformly distributed in (0, 1], never 0 so that
+   its logarithm is always finite.
+   rng_below returns an integer uniformly distributed in [0, n) without modulo
+   bias (Lemire's multiply and reject method) and rng_jump advances the state
+   by 2^128 draws, so that successive jumps of the same seed give
+   non-overlapping streams
+*/
+
+uint64_t splitmix64(uint64_t * x){
+   uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+   z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+   return z ^ (z >> 31);
+}
+
+void rng_seed(rng_t * r, uint64_t seed){
+   int i;
+   for (i=0;i<4;i++){
+      r->s[i] = splitmix64(&seed);
+   }
+}
+
+static inline uint64_t rotl(uint64_t x, int k){
+   return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(rng_t * r){
+   uint64_t * s = r->s;
+   uint64_t result = rotl(s[1] * 5, 7) * 9;
+   uint64_t t = s[1] << 17;
+   s[2] ^= s[0];
+   s[3] ^= s[1];
+   s[1] ^= s[2];
+   s[0] ^= s[3];
+   s[2] ^= t;
+   s[3] = rotl(s[3], 45);
+   return result;
+}
+
+static inline double rng_unit(rng_t * r){
+   return (double) ((rng_next(r) >> 11) + 1) * 0x1p-53;
+}
+
+static inline uint32_t rng_below(rng_t * r, uint32_t n){
+   uint64_t m = (rng_next(r) >> 32) * n;
+   if ((uint32_t) m < n){
+      uint32_t threshold = -n % n;
+      while ((uint32_t) m < threshold){
+         m = (rng_next(r) >> 32) * n;
+      }
+   }
+   return (uint32_t) (m >> 32);
+}
+
+void rng_jump(rng_t * r){
+   static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL,
+      0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+   uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+   int i,b;
+   for (i=0;i<4;i++){
+      for (b=0;b<64;b++){
+         if (JUMP[i] & ((uint64_t) 1 << b)){
+            s0 ^= r->s[0];
+            s1 ^= r->s[1];
+            s2 ^= r->s[2];
+            s3 ^= r->s[3];
+         }
+         rng_next(r);
+      }
+   }
+   r->s[0] = s0;
+   r->s[1] = s1;
+   r->s[2] = s2;
+   r->s[3] = s3;
+}
+
+
+/*
+   Function to cut n independent streams out of one seed: stream 0 is the
+   seeded generator and every next stream is the previous one jumped
+*/
+
+void rng_streams(rng_t * streams, int n, uint64_t seed){
+   int i;
+   rng_seed(&streams[0], seed);
+   for (i=1;i<n;i++){
+      streams[i] = streams[i-1];
+      rng_jump(&streams[i]);
+   }
+}
+
+
+/*
+   Function to get the number of the calling thread, which is also the index
+   of its stream of random numbers
+*/
+
+static inline int thread_id(void){
+#ifdef _OPENMP
+   return omp_get_thread_num();
+#else
+   return 0;
+#endif
+}
+
+
+/*
+   Function to get the pointer to a row of the population matrix
+*/
+
+word_t * row_genome(const config * c, const population * p, int row){
+   return p->genome + (size_t) row * c->stride;
+}
+
+
+/*
+   Function to round n up to a multiple of "to", for the alignment of the
+   rows, the arena and the sections of a checkpoint
+*/
+
+static size_t round_up(size_t n, size_t to){
+   return (n + to - 1) / to * to;
+}
+
+
+/*
+   Functions of the arena. arena_init maps a zeroed block of at least "size"
+   bytes and returns 0, or 1 if there is not enough memory. arena_alloc
+   returns NULL when the arena is full
+*/
+
+int arena_init(arena * a, size_t size){
+   size_t align = size >= HUGE_PAGE_BYTES ? HUGE_PAGE_BYTES : SMALL_PAGE_BYTES;
+   size_t map = round_up(size, align) + align - SMALL_PAGE_BYTES;
+   size_t off;
+   char * m = mmap(NULL, map, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (m == MAP_FAILED){
+      return 1;
+   }
+   /* Trim the mapping to a block aligned to "align" */
+   char * base = (char *) round_up((size_t) m, align);
+   size = round_up(size, align);
+   if (base > m){
+      munmap(m, (size_t) (base - m));
+   }
+   if (m + map > base + size){
+      munmap(base + size, (size_t) (m + map - (base + size)));
+   }
+#ifdef MADV_HUGEPAGE
+   if (align == HUGE_PAGE_BYTES){
+      madvise(base, size, MADV_HUGEPAGE);
+   }
+#endif
+   for (off=0;off<size;off+=SMALL_PAGE_BYTES){
+      base[off] = 0;
+   }
+   a->base = base;
+   a->size = size;
+   a->used = 0;
+   a->mark = 0;
+   return 0;
+}
+
+void * arena_alloc(arena * a, size_t bytes){
+   size_t start = round_up(a->used, ALIGN_BYTES);
+   if (start + bytes > a->size){
+      return NULL;
+   }
+   a->used = start + bytes;
+   return a->base + start;
+}
+
+void arena_mark(arena * a){
+   a->mark = a->used;
+}
+
+void arena_reset(arena * a){
+   a->used = a->mark;
+}
+
+void arena_free(arena * a){
+   if (a->base != NULL){
+      munmap(a->base, a->size);
+      a->base = NULL;
+   }
+}
+
+
+/*
+   Functions to allocate and free a population for the given configuration.
+   All of its buffers are carved from a single arena sized by
+   population_bytes: each generation of genomes is one contiguous block
+   aligned to ALIGN_BYTES (the padding words of every row start zeroed, as
+   the whole arena does), followed by the scores, the ranking and, at the
+   end, the scratch of one generation, as large as the largest of the
+   selection buffers and the queues of async_generation. new_population
+   returns NULL if there is not enough memory. reuse_population carves the
+   buffers again for another configuration, in an arena at least
+   population_bytes(c) large, and clears the genomes
+*/
+
+size_t selection_bytes(const config * c){
+   size_t parents = (size_t) (c->offspring + c->bottleneck) * sizeof(int);
+   size_t alias = (size_t) c->p_size * sizeof(alias_t);
+   return parents > alias ? parents : alias;
+}
+
+size_t async_bytes(const config * c);
+
+size_t population_bytes(const config * c){
+   size_t scratch = selection_bytes(c) > async_bytes(c) ?
+                    selection_bytes(c) : async_bytes(c);
+   size_t genomes = (size_t) c->p_size * c->stride * sizeof(word_t);
+   size_t scores = round_up((size_t) c->p_size * sizeof(float), ALIGN_BYTES);
+   return 2 * genomes + 2 * scores +
+          round_up((size_t) c->p_size * sizeof(int), ALIGN_BYTES) +
+          round_up((size_t) c->p_size * sizeof(fkey), ALIGN_BYTES) +
+          round_up((size_t) (c->obj->levels + 1) * sizeof(int), ALIGN_BYTES) +
+          round_up((size_t) c->g_words * WORD_BITS * sizeof(int),
+                   ALIGN_BYTES) +
+          (c->steady_state ? 4 * round_up((size_t) c->p_size * sizeof(int),
+                                          ALIGN_BYTES) : 0) +
+          scratch;
+}
+
+void free_population(population * p){
+   if (p == NULL){
+      return;
+   }
+   arena_free(&p->mem);
+   free(p);
+}
+
+static void carve_population(const config * c, population * p){
+   size_t genomes = (size_t) c->p_size * c->stride * sizeof(word_t);
+   p->mem.used = 0;
+   p->genome = arena_alloc(&p->mem, genomes);
+   p->next = arena_alloc(&p->mem, genomes);
+   p->score = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(float));
+   p->next_score = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(float));
+   p->order = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(int));
+   p->keys = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(fkey));
+   p->buckets = arena_alloc(&p->mem,
+                            (size_t) (c->obj->levels + 1) * sizeof(int));
+   p->alleles = arena_alloc(&p->mem,
+                            (size_t) c->g_words * WORD_BITS * sizeof(int));
+   if (c->steady_state){
+      p->worst.rows = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(int));
+      p->worst.pos = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(int));
+      p->fittest.rows = arena_alloc(&p->mem,
+                                    (size_t) c->p_size * sizeof(int));
+      p->fittest.pos = arena_alloc(&p->mem, (size_t) c->p_size * sizeof(int));
+   }
+   arena_mark(&p->mem);
+   memset(p->phase, 0, sizeof(p->phase));
+}
+
+population * new_population(const config * c){
+   population * p = calloc(1, sizeof(population));
+   if (p == NULL || arena_init(&p->mem, population_bytes(c))){
+      free(p);
+      return NULL;
+   }
+   carve_population(c, p);
+   return p;
+}
+
+void reuse_population(const config * c, population * p){
+   carve_population(c, p);
+   memset(p->genome, 0, (size_t) c->p_size * c->stride * sizeof(word_t));
+   memset(p->next, 0, (size_t) c->p_size * c->stride * sizeof(word_t));
+}
+
+
+/*
+   Function to generate a random population. It is just a random binary matrix
+   of g_size x p_size, packed in words and filled one whole word per draw of
+   the generator. The bits past g_size in the last word are cleared. The
+   population must be allocated beforehand, and iven as the argument to the
+   funcion together with one stream of random numbers per thread
+*/
+
+void rand_population(const config * c, population * p, rng_t * r) {
+   double t = phase_start(c);
+   word_t tail = c->g_size % WORD_BITS ?
+                 ((word_t) 1 << (c->g_size % WORD_BITS)) - 1 : ~(word_t) 0;
+   int i;
+   #pragma omp parallel for num_threads(c->threads) schedule(static)
+   for (i=0;i<c->p_size;i++){
+      rng_t * rt = &r[thread_id()];
+      word_t * genome = row_genome(c, p, i);
+      int j;
+      for (j=0;j<c->g_words;j++){
+         genome[j] = rng_next(rt);
+      }
+      genome[c->g_words-1] &= tail;
+      p->order[i] = i;
+   }
+   phase_end(c, p, PHASE_INIT, t);
+}
+
+
+/*
+   The kernels: the loops over whole genomes that take most of the time,
+   written once as inline bodies and compiled for several instruction sets.
+   count_ones_body counts the ones of n words, count_rows_body the ones of
+   "rows" genomes of n words stored "stride" words apart (the OneMax batch)
+   and blend_body is the inner loop of the uniform crossover, taking the
+   mask words already drawn and returning the change in ones of offspring1.
+   segment_body swaps the genes [from, to) of two genomes, the one and two
+   points crossovers, without a branch: the mask of every word is computed
+   from the cut points rather than tested.
+   A kernel set is the four of them compiled for one target. The set is
+   chosen at startup by select_kernels(), the best one the processor
+   supports unless one is forced by name; "supported" is NULL for the
+   generic set, which runs everywhere.
+   The count_rows kernels stream through the population block, so they may
+   count every row up to n rounded up to ALIGN_WORDS: those words are the
+   padding of the row, which is always zero, and the rows start at a
+   multiple of ALIGN_BYTES, so every vector is a whole aligned load.
+   The genome lengths of FIXED_WORDS words get their own copy of the loops
+   over whole genomes, with n a constant the compiler fully unrolls; the
+   kernels switch on n to it and any other length takes the generic loop.
+   fixed_words(n) tells the callers whether n is one of them
+*/
+
+#define FIXED_WORDS(X) X(1) X(2) X(4) X(8) X(16)
+
+#define IS_FIXED_WORDS(N) || n == N
+
+static inline int fixed_words(int n){
+   return 0 FIXED_WORDS(IS_FIXED_WORDS);
+}
+
+static inline __attribute__((always_inline))
+int count_ones_body(const word_t * genome, int n){
+   int ones=0;
+   int j;
+   for (j=0;j<n;j++){
+      ones += __builtin_popcountll(genome[j]);
+   }
+   return ones;
+}
+
+static inline __attribute__((always_inline))
+void count_rows_body(const word_t * genomes, size_t stride, int n, int rows,
+                     float * out){
+   int i;
+   for (i=0;i<rows;i++){
+      out[i] = (float) count_ones_body(genomes + (size_t) i * stride, n);
+   }
+}
+
+static inline __attribute__((always_inline))
+int blend_body(const word_t * restrict parent1,
+               const word_t * restrict parent2, word_t * restrict offspring1,
+               word_t * restrict offspring2, const word_t * restrict masks,
+               int n){
+   int d = 0;
+   int j;
+   for (j=0;j<n;j++){
+      word_t m = masks[j];
+      offspring1[j] = (parent1[j] & m) | (parent2[j] & ~m);
+      offspring2[j] = (parent2[j] & m) | (parent1[j] & ~m);
+      d += __builtin_popcountll(parent2[j] & ~m) -
+           __builtin_popcountll(parent1[j] & ~m);
+   }
+   return d;
+}
+
+/* The genes at or after the x-th one of a word (all of them if x <= 0) */
+static inline __attribute__((always_inline))
+word_t genes_from(int x){
+   int s = x < 0 ? 0 : x;
+   word_t m = ~(word_t) 0 << (s & (WORD_BITS - 1));
+   return s < WORD_BITS ? m : 0;
+}
+
+static inline __attribute__((always_inline))
+int segment_body(const word_t * restrict parent1,
+                 const word_t * restrict parent2, word_t * restrict offspring1,
+                 word_t * restrict offspring2, int n, int from, int to){
+   int d = 0;
+   int j;
+   for (j=0;j<n;j++){
+      word_t m = genes_from(from - j * WORD_BITS) &
+                 ~genes_from(to - j * WORD_BITS);
+      offspring1[j] = (parent1[j] & ~m) | (parent2[j] & m);
+      offspring2[j] = (parent2[j] & ~m) | (parent1[j] & m);
+      d += __builtin_popcountll(parent2[j] & m) -
+           __builtin_popcountll(parent1[j] & m);
+   }
+   return d;
+}
+
+typedef struct {
+   const char * name;
+   int (*supported)(void);
+   int (*count_ones)(const word_t * genome, int n);
+   void (*count_rows)(const word_t * genomes, size_t stride, int n, int rows,
+                      float * out);
+   int (*blend)(const word_t * parent1, const word_t * parent2,
+                word_t * offspring1, word_t * offspring2,
+                const word_t * masks, int n);
+   int (*segment)(const word_t * parent1, const word_t * parent2,
+                  word_t * offspring1, word_t * offspring2, int n, int from,
+                  int to);
+} kernel_set;
+
+/* Defines the kernels of a set, compiled with the given target attribute */
+#define DEFINE_KERNELS(suffix, attr) \
+   attr static int count_ones_##suffix(const word_t * genome, int n){ \
+      return count_ones_body(genome, n); \
+   } \
+   attr static void count_rows_##suffix(const word_t * genomes, \
+                                        size_t stride, int n, int rows, \
+                                        float * out){ \
+      switch (n){ \
+         FIXED_WORDS(COUNT_ROWS_CASE) \
+      default: \
+         count_rows_body(genomes, stride, n, rows, out); \
+      } \
+   } \
+   DEFINE_BLEND(suffix, attr)
+
+/*
+   Defines only the crossover kernels, blend and segment, for the sets with
+   their own counters
+*/
+#define DEFINE_BLEND(suffix, attr) \
+   attr static int blend_##suffix(const word_t * parent1, \
+                                  const word_t * parent2, \
+                                  word_t * offspring1, word_t * offspring2, \
+                                  const word_t * masks, int n){ \
+      return blend_body(parent1, parent2, offspring1, offspring2, masks, n); \
+   } \
+   attr static int segment_##suffix(const word_t * parent1, \
+                                    const word_t * parent2, \
+                                    word_t * offspring1, \
+                                    word_t * offspring2, int n, int from, \
+                                    int to){ \
+      switch (n){ \
+         FIXED_WORDS(SEGMENT_CASE) \
+      default: \
+         return segment_body(parent1, parent2, offspring1, offspring2, n, \
+                             from, to); \
+      } \
+   }
+
+#define COUNT_ROWS_CASE(N) \
+   case N: \
+      count_rows_body(genomes, stride, N, rows, out); \
+      return;
+
+#define SEGMENT_CASE(N) \
+   case N: \
+      return segment_body(parent1, parent2, offspring1, offspring2, N, \
+                          from, to);
+
+#define KERNEL_SET(name, suffix, supported) \
+   {name, supported, count_ones_##suffix, count_rows_##suffix, \
+    blend_##suffix, segment_##suffix}
+
+DEFINE_KERNELS(generic, )
+
+#ifdef GA_X86_KERNELS
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512vpopcntdq," \
+                                            "avx512bw,avx512vl,popcnt")))
+
+DEFINE_KERNELS(popcnt, __attribute__((target("popcnt"))))
+DEFINE_BLEND(avx2, TARGET_AVX2)
+DEFINE_BLEND(avx512, TARGET_AVX512)
+
+/*
+   AVX2 has no vector popcount. popcount_avx2 counts the ones of the four
+   words of a vector with Mula's method: the ones of every nibble are looked
+   up with a byte shuffle, and the bytes of each word are summed with
+   sad_epu8. Long genomes go through harley_seal_avx2, which first adds 16
+   vectors at a time with a tree of carry-save adders (Harley-Seal), so that
+   only one vector in 16 needs a popcount
+*/
+
+TARGET_AVX2 static inline __m256i popcount_avx2(__m256i v){
+   const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3,
+                                           1, 2, 2, 3, 2, 3, 3, 4);
+   const __m256i nibble = _mm256_set1_epi8(0x0f);
+   __m256i lo = _mm256_and_si256(v, nibble);
+   __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+   __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                   _mm256_shuffle_epi8(lookup, hi));
+   return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+#define CSA_AVX2(h, l, a, b, c) { \
+   __m256i u = _mm256_xor_si256(a, b); \
+   h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c)); \
+   l = _mm256_xor_si256(u, c); \
+}
+
+#define LOAD_AVX2(i) _mm256_loadu_si256((const __m256i *) (genome + (i) * 4))
+
+TARGET_AVX2 static inline __attribute__((always_inline))
+__m256i harley_seal_avx2(const word_t * genome, int nv){
+   __m256i total = _mm256_setzero_si256();
+   __m256i ones = _mm256_setzero_si256();
+   __m256i twos = _mm256_setzero_si256();
+   __m256i fours = _mm256_setzero_si256();
+   __m256i eights = _mm256_setzero_si256();
+   __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+   int i;
+   for (i=0;i+16<=nv;i+=16){
+      CSA_AVX2(twos_a, ones, ones, LOAD_AVX2(i), LOAD_AVX2(i+1));
+      CSA_AVX2(twos_b, ones, ones, LOAD_AVX2(i+2), LOAD_AVX2(i+3));
+      CSA_AVX2(fours_a, twos, twos, twos_a, twos_b);
+      CSA_AVX2(twos_a, ones, ones, LOAD_AVX2(i+4), LOAD_AVX2(i+5));
+      CSA_AVX2(twos_b, ones, ones, LOAD_AVX2(i+6), LOAD_AVX2(i+7));
+      CSA_AVX2(fours_b, twos, twos, twos_a, twos_b);
+      CSA_AVX2(eights_a, fours, fours, fours_a, fours_b);
+      CSA_AVX2(twos_a, ones, ones, LOAD_AVX2(i+8), LOAD_AVX2(i+9));
+      CSA_AVX2(twos_b, ones, ones, LOAD_AVX2(i+10), LOAD_AVX2(i+11));
+      CSA_AVX2(fours_a, twos, twos, twos_a, twos_b);
+      CSA_AVX2(twos_a, ones, ones, LOAD_AVX2(i+12), LOAD_AVX2(i+13));
+      CSA_AVX2(twos_b, ones, ones, LOAD_AVX2(i+14), LOAD_AVX2(i+15));
+      CSA_AVX2(fours_b, twos, twos, twos_a, twos_b);
+      CSA_AVX2(eights_b, fours, fours, fours_a, fours_b);
+      CSA_AVX2(sixteens, eights, eights, eights_a, eights_b);
+      total = _mm256_add_epi64(total, popcount_avx2(sixteens));
+   }
+   total = _mm256_slli_epi64(total, 4);
+   total = _mm256_add_epi64(total,
+                            _mm256_slli_epi64(popcount_avx2(eights), 3));
+   total = _mm256_add_epi64(total,
+                            _mm256_slli_epi64(popcount_avx2(fours), 2));
+   total = _mm256_add_epi64(total,
+                            _mm256_slli_epi64(popcount_avx2(twos), 1));
+   total = _mm256_add_epi64(total, popcount_avx2(ones));
+   for (;i<nv;i++){
+      total = _mm256_add_epi64(total, popcount_avx2(LOAD_AVX2(i)));
+   }
+   return total;
+}
+
+TARGET_AVX2 static int sum_avx2(__m256i v){
+   __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v),
+                             _mm256_extracti128_si256(v, 1));
+   return (int) (_mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1));
+}
+
+TARGET_AVX2 static int count_ones_avx2(const word_t * genome, int n){
+   int nv = n / 4;
+   int ones = sum_avx2(harley_seal_avx2(genome, nv));
+   int j;
+   for (j=nv*4;j<n;j++){
+      ones += __builtin_popcountll(genome[j]);
+   }
+   return ones;
+}
+
+TARGET_AVX2 static inline __attribute__((always_inline))
+void count_rows_avx2_body(const word_t * genomes, size_t stride, int n,
+                          int rows, float * out){
+   int padded = (int) round_up((size_t) n, ALIGN_WORDS);
+   int i;
+   if (n < 4){
+      count_rows_body(genomes, stride, n, rows, out);
+      return;
+   }
+   for (i=0;i<rows;i++){
+      const word_t * genome = genomes + (size_t) i * stride;
+      out[i] = (float) sum_avx2(harley_seal_avx2(genome, padded / 4));
+   }
+}
+
+#define COUNT_ROWS_AVX2_CASE(N) \
+   case N: \
+      count_rows_avx2_body(genomes, stride, N, rows, out); \
+      return;
+
+TARGET_AVX2 static void count_rows_avx2(const word_t * genomes,
+                                        size_t stride, int n, int rows,
+                                        float * out){
+   switch (n){
+      FIXED_WORDS(COUNT_ROWS_AVX2_CASE)
+   default:
+      count_rows_avx2_body(genomes, stride, n, rows, out);
+   }
+}
+
+/*
+   AVX-512 VPOPCNTDQ counts the ones of eight words per instruction. Four
+   accumulators hide its latency on long genomes, and the words left over
+   at the end of count_ones_avx512 are read with a masked load
+*/
+
+TARGET_AVX512 static int count_ones_avx512(const word_t * genome, int n){
+   __m512i a0 = _mm512_setzero_si512();
+   __m512i a1 = _mm512_setzero_si512();
+   __m512i a2 = _mm512_setzero_si512();
+   __m512i a3 = _mm512_setzero_si512();
+   int j;
+   for (j=0;j+32<=n;j+=32){
+      a0 = _mm512_add_epi64(a0, _mm512_popcnt_epi64(
+                                   _mm512_loadu_si512(genome + j)));
+      a1 = _mm512_add_epi64(a1, _mm512_popcnt_epi64(
+                                   _mm512_loadu_si512(genome + j + 8)));
+      a2 = _mm512_add_epi64(a2, _mm512_popcnt_epi64(
+                                   _mm512_loadu_si512(genome + j + 16)));
+      a3 = _mm512_add_epi64(a3, _mm512_popcnt_epi64(
+                                   _mm512_loadu_si512(genome + j + 24)));
+   }
+   for (;j+8<=n;j+=8){
+      a0 = _mm512_add_epi64(a0, _mm512_popcnt_epi64(
+                                   _mm512_loadu_si512(genome + j)));
+   }
+   if (j < n){
+      __mmask8 m = (__mmask8) ((1u << (n - j)) - 1);
+      a1 = _mm512_add_epi64(a1, _mm512_popcnt_epi64(
+                                   _mm512_maskz_loadu_epi64(m, genome + j)));
+   }
+   a0 = _mm512_add_epi64(_mm512_add_epi64(a0, a1), _mm512_add_epi64(a2, a3));
+   return (int) _mm512_reduce_add_epi64(a0);
+}
+
+TARGET_AVX512 static inline __attribute__((always_inline))
+void count_rows_avx512_body(const word_t * genomes, size_t stride, int n,
+                            int rows, float * out){
+   int padded = (int) round_up((size_t) n, ALIGN_WORDS);
+   int i,j;
+   if (n < 4){
+      count_rows_body(genomes, stride, n, rows, out);
+      return;
+   }
+   for (i=0;i<rows;i++){
+      const word_t * genome = genomes + (size_t) i * stride;
+      __m512i a0 = _mm512_popcnt_epi64(_mm512_load_si512(genome));
+      __m512i a1 = _mm512_setzero_si512();
+      for (j=8;j+16<=padded;j+=16){
+         a1 = _mm512_add_epi64(a1, _mm512_popcnt_epi64(
+                                      _mm512_load_si512(genome + j)));
+         a0 = _mm512_add_epi64(a0, _mm512_popcnt_epi64(
+                                      _mm512_load_si512(genome + j + 8)));
+      }
+      if (j < padded){
+         a1 = _mm512_add_epi64(a1, _mm512_popcnt_epi64(
+                                      _mm512_load_si512(genome + j)));
+      }
+      out[i] = (float) _mm512_reduce_add_epi64(_mm512_add_epi64(a0, a1));
+   }
+}
+
+#define COUNT_ROWS_AVX512_CASE(N) \
+   case N: \
+      count_rows_avx512_body(genomes, stride, N, rows, out); \
+      return;
+
+TARGET_AVX512 static void count_rows_avx512(const word_t * genomes,
+                                            size_t stride, int n, int rows,
+                                            float * out){
+   switch (n){
+      FIXED_WORDS(COUNT_ROWS_AVX512_CASE)
+   default:
+      count_rows_avx512_body(genomes, stride, n, rows, out);
+   }
+}
+
+static int cpu_popcnt(void){
+   return __builtin_cpu_supports("popcnt");
+}
+
+static int cpu_avx2(void){
+   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+static int cpu_avx512(void){
+   return __builtin_cpu_supports("avx512f") &&
+          __builtin_cpu_supports("avx512vpopcntdq") &&
+          __builtin_cpu_supports("avx512bw") &&
+          __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+/* From the best to the generic one, which must be the last */
+static const kernel_set kernel_sets[] = {
+#ifdef GA_X86_KERNELS
+   KERNEL_SET("avx512", avx512, cpu_avx512),
+   KERNEL_SET("avx2", avx2, cpu_avx2),
+   KERNEL_SET("popcnt", popcnt, cpu_popcnt),
+#endif
+   KERNEL_SET("generic", generic, NULL)
+};
+#define N_KERNEL_SETS ((int) (sizeof(kernel_sets) / sizeof(kernel_sets[0])))
+
+/* The kernel set in use, set by select_kernels() */
+static const kernel_set * kernels = &kernel_sets[N_KERNEL_SETS - 1];
+
+/*
+   Function to choose the kernel set: the one called "name" or, if name is
+   NULL or "auto", the first one the processor supports. Returns 0 on
+   success and 1 if the requested set is unknown or not supported here
+*/
+
+int select_kernels(const char * name){
+   int auto_select = name == NULL || strcmp(name, "auto") == 0;
+   int k;
+#ifdef GA_X86_KERNELS
+   __builtin_cpu_init();
+#endif
+   for (k=0;k<N_KERNEL_SETS;k++){
+      const kernel_set * ks = &kernel_sets[k];
+      if (!auto_select && strcmp(name, ks->name) != 0){
+         continue;
+      }
+      if (ks->supported == NULL || ks->supported()){
+         kernels = ks;
+         return 0;
+      }
+      if (!auto_select){
+         fprintf(stderr, "The %s kernels are not supported by this "
+                         "processor\n", name);
+         return 1;
+      }
+   }
+   fprintf(stderr, "Invalid value for --kernels: %s\n", name);
+   return 1;
+}
+
+
+/*
+   Function to count the number of ones in a packed genome of n words, with
+   the kernel set chosen by select_kernels()
+*/
+
+int count_ones(const word_t * genome, int n){
+   return kernels->count_ones(genome, n);
+}
+
+
+/*
+   The fitness functions. OneMax is the original one, the number of ones in
+   the word. LeadingOnes is the number of consecutive ones from the first
+   gene on, which only grows one gene at a time
+*/
+
+void eval_onemax(const objective * o, const config * c,
+                 const word_t * genomes, int n, float * out){
+   (void) o;
+   kernels->count_rows(genomes, (size_t) c->stride, c->g_words, n, out);
+}
+
+void eval_leadingones(const objective * o, const config * c,
+                      const word_t * genomes, int n, float * out){
+   int i,j;
+   (void) o;
+   for (i=0;i<n;i++){
+      const word_t * genome = genomes + (size_t) i * c->stride;
+      int lead = 0;
+      for (j=0;j<c->g_words && genome[j] == ~(word_t) 0;j++){
+         lead += WORD_BITS;
+      }
+      if (j < c->g_words){
+         lead += __builtin_ctzll(~genome[j]);
+      }
+      out[i] = (float) (lead < c->g_size ? lead : c->g_size);
+   }
+}
+
+/*
+   Table of the fitness functions that can be chosen with --fitness. The
+   first one is the default. max_score and levels depend on the genome size,
+   so they are filled in by read_config()
+*/
+objective objectives[] = {
+   {"onemax", eval_onemax, 0, 0, 1, NULL},
+   {"leadingones", eval_leadingones, 0, 0, 0, NULL}
+};
+#define N_OBJECTIVES ((int) (sizeof(objectives) / sizeof(objectives[0])))
+
+
+/*
+   Function to choose the fitter of two rows given their scores, the lower
+   row on ties (the order of the ranking). A row of -1 loses against any
+*/
+
+static inline int fitter(const float * score, int a, int b){
+   if (a < 0){
+      return b;
+   }
+   if (b < 0){
+      return a;
+   }
+   if (score[a] > score[b] || (score[a] == score[b] && a < b)){
+      return a;
+   }
+   return b;
+}
+
+
+/*
+   The fitness memo: a bounded table of the scores of the genomes evaluated
+   so far, keyed by a 64-bit hash of the packed genome (and the genome size),
+   so that the duplicates bred late in a run, or by a crossover point at the
+   very end of the genome, skip the fitness function. It is only consulted
+   by the full evaluations, which incremental objectives do not need. A
+   memo is a shared, set-associative table of MEMO_WAYS entries per set,
+   one cache line, replaced with CLOCK: every set has a hand, the entries
+   found by a lookup get their reference bit set, and an insertion into a
+   full set takes the first entry the hand finds unreferenced, clearing the
+   bits it passes over.
+   Any number of threads may look up and insert at once without locks. An
+   insertion claims its entry by swapping the key for MEMO_BUSY, then writes
+   the score and releases the real key, and a lookup only trusts a score if
+   it read the same key before and after it (the fences between the claim
+   and the score, and between the score and the second key, make a lookup
+   that reads a new score also read the claim, as in a seqlock); an entry
+   claimed by another thread is simply not inserted, the memo being a
+   cache. Keys 0 (empty) and MEMO_BUSY are never hashes. Two genomes with
+   the same hash would share a score, which is possible but has a
+   probability of about one in 2^64 per pair
+*/
+#define MEMO_WAYS 4
+#define MEMO_BUSY 1
+
+typedef struct {
+   _Atomic uint64_t key;
+   _Atomic uint32_t score;
+   _Atomic uint32_t referenced;
+} memo_entry;
+
+struct memo_table {
+   memo_entry * entries;
+   _Atomic uint8_t * hands;
+   size_t sets;
+   _Atomic uint64_t lookups;
+   _Atomic uint64_t hits;
+   arena mem;
+};
+
+uint64_t hash_genome(const word_t * genome, int n, uint64_t seed){
+   uint64_t h = seed;
+   int j;
+   for (j=0;j<n;j++){
+      h = (h ^ genome[j]) * 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+   }
+   h = splitmix64(&h);
+   return h > MEMO_BUSY ? h : h + MEMO_BUSY + 1;
+}
+
+int open_memo(config * c, memo_table * m){
+   size_t sets = 1;
+   while (sets * MEMO_WAYS < (size_t) c->memo_size){
+      sets *= 2;
+   }
+   if (arena_init(&m->mem, sets * MEMO_WAYS * sizeof(memo_entry) + sets)){
+      fprintf(stderr, "Not enough memory for the memo\n");
+      return 1;
+   }
+   m->entries = arena_alloc(&m->mem, sets * MEMO_WAYS * sizeof(memo_entry));
+   m->hands = arena_alloc(&m->mem, sets);
+   m->sets = sets;
+   atomic_init(&m->lookups, 0);
+   atomic_init(&m->hits, 0);
+   c->memo = m;
+   return 0;
+}
+
+void close_memo(config * c){
+   if (c->memo != NULL){
+      arena_free(&c->memo->mem);
+      c->memo = NULL;
+   }
+}
+
+
+/*
+   Function to print the hit rate of the memo, if any. With MPI the counters
+   of every rank are summed on rank 0, which prints them for the whole run
+*/
+
+void print_memo(const config * c){
+   if (c->memo != NULL){
+      uint64_t lookups = atomic_load(&c->memo->lookups);
+      uint64_t hits = atomic_load(&c->memo->hits);
+#ifdef GA_MPI
+      if (mpi_ranks > 1){
+         uint64_t local[2] = {lookups, hits};
+         uint64_t total[2] = {0, 0};
+         MPI_Reduce(local, total, 2, MPI_UINT64_T, MPI_SUM, 0,
+                    MPI_COMM_WORLD);
+         lookups = total[0];
+         hits = total[1];
+      }
+#endif
+      if (mpi_rank != 0){
+         return;
+      }
+      printf("Memo hits: %llu of %llu (%.1f%%)\n", (unsigned long long) hits,
+             (unsigned long long) lookups,
+             lookups > 0 ? 100.0 * (double) hits / (double) lookups : 0);
+   }
+}
+
+static int memo_find(memo_table * m, uint64_t key, float * score){
+   memo_entry * set = m->entries + (key & (m->sets - 1)) * MEMO_WAYS;
+   int k;
+   for (k=0;k<MEMO_WAYS;k++){
+      memo_entry * e = &set[k];
+      if (atomic_load_explicit(&e->key, memory_order_acquire) != key){
+         continue;
+      }
+      uint32_t bits = atomic_load_explicit(&e->score, memory_order_relaxed);
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&e->key, memory_order_relaxed) != key){
+         return 0;
+      }
+      if (!atomic_load_explicit(&e->referenced, memory_order_relaxed)){
+         atomic_store_explicit(&e->referenced, 1, memory_order_relaxed);
+      }
+      memcpy(score, &bits, sizeof(float));
+      return 1;
+   }
+   return 0;
+}
+
+static void memo_insert(memo_table * m, uint64_t key, float score){
+   size_t s = key & (m->sets - 1);
+   memo_entry * set = m->entries + s * MEMO_WAYS;
+   memo_entry * victim = NULL;
+   uint64_t old;
+   uint32_t bits;
+   int k;
+   for (k=0;k<MEMO_WAYS;k++){
+      old = atomic_load_explicit(&set[k].key, memory_order_relaxed);
+      if (old == key || old == MEMO_BUSY){
+         return;
+      }
+      if (old == 0 && victim == NULL){
+         victim = &set[k];
+      }
+   }
+   if (victim == NULL){
+      int hand = atomic_load_explicit(&m->hands[s], memory_order_relaxed);
+      for (k=0;k<2*MEMO_WAYS && victim == NULL;k++){
+         memo_entry * e = &set[(hand + k) % MEMO_WAYS];
+         if (atomic_load_explicit(&e->referenced, memory_order_relaxed)){
+            atomic_store_explicit(&e->referenced, 0, memory_order_relaxed);
+         }else{
+            victim = e;
+         }
+      }
+      if (victim == NULL){
+         return;
+      }
+      atomic_store_explicit(&m->hands[s],
+                            (uint8_t) ((victim - set + 1) % MEMO_WAYS),
+                            memory_order_relaxed);
+   }
+   old = atomic_load_explicit(&victim->key, memory_order_relaxed);
+   if (old == MEMO_BUSY ||
+       !atomic_compare_exchange_strong_explicit(&victim->key, &old, MEMO_BUSY,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)){
+      return;
+   }
+   atomic_thread_fence(memory_order_release);
+   memcpy(&bits, &score, sizeof(float));
+   atomic_store_explicit(&victim->score, bits, memory_order_relaxed);
+   atomic_store_explicit(&victim->referenced, 0, memory_order_relaxed);
+   atomic_store_explicit(&victim->key, key, memory_order_release);
+}
+
+
+/*
+   Function to score n genomes stored c->stride words apart, the way every
+   full evaluation goes: straight to the fitness function without a memo, and
+   otherwise looking every genome up first, the runs of consecutive misses
+   (up to MEMO_BATCH long, whose keys are kept for the insertion) being
+   handed to the fitness function as one batch each and inserted afterwards
+*/
+#define MEMO_BATCH 256
+
+void evaluate_genomes(const config * c, const word_t * genomes, int n,
+                      float * out){
+   memo_table * m = c->memo;
+   uint64_t seed = (uint64_t) c->g_size;
+   uint64_t keys[MEMO_BATCH];
+   int hits = 0;
+   int i = 0;
+   if (m == NULL){
+      c->obj->eval(c->obj, c, genomes, n, out);
+      return;
+   }
+   while (i < n){
+      int j = i;
+      int found = 0;
+      while (j < n && j - i < MEMO_BATCH){
+         keys[j-i] = hash_genome(genomes + (size_t) j * c->stride,
+                                 c->g_words, seed);
+         if (memo_find(m, keys[j-i], &out[j])){
+            found = 1;
+            break;
+         }
+         j++;
+      }
+      if (j > i){
+         int k;
+         c->obj->eval(c->obj, c, genomes + (size_t) i * c->stride, j - i,
+                      out + i);
+         for (k=i;k<j;k++){
+            memo_insert(m, keys[k-i], out[k]);
+         }
+      }
+      hits += found;
+      i = j + found;
+   }
+   atomic_fetch_add_explicit(&m->lookups, (uint64_t) n,
+                             memory_order_relaxed);
+   atomic_fetch_add_explicit(&m->hits, (uint64_t) hits,
+                             memory_order_relaxed);
+}
+
+
+/*
+   Function to refresh the fitness cache of the rows [from, to) of a block of
+   genomes after they have been written. This is the only place where the
+   genomes are scanned: the rows are split in one contiguous batch per
+   thread, and each batch is handed to the fitness function in a single call.
+   Every thread then picks the fittest row of its batch while the scores are
+   still in cache, and the row of the fittest of all is returned
+*/
+
+int evaluate_rows(const config * c, const word_t * genomes, float * score,
+                  int from, int to){
+   int n = to - from;
+   int t = c->threads < n ? c->threads : 1;
+   int best = -1;
+   #pragma omp parallel num_threads(t) if(t > 1)
+   {
+      int id = thread_id();
+      int nt = t > 1 ? t : 1;
+#ifdef _OPENMP
+      nt = omp_get_num_threads();
+#endif
+      int lo = from + (int) ((long long) n * id / nt);
+      int hi = from + (int) ((long long) n * (id + 1) / nt);
+      int local = -1;
+      int i;
+      if (hi > lo){
+         evaluate_genomes(c, genomes + (size_t) lo * c->stride, hi - lo,
+                          score + lo);
+      }
+      for (i=lo;i<hi;i++){
+         local = fitter(score, local, i);
+      }
+      #pragma omp critical
+      best = fitter(score, best, local);
+   }
+   return best;
+}
+
+void evaluate_population(const config * c, population * p){
+   double t = phase_start(c);
+   p->best = evaluate_rows(c, p->genome, p->score, 0, c->p_size);
+   phase_end(c, p, PHASE_EVALUATE, t);
+}
+
+
+/*
+   Function to calculate the fitness (between 0 and 1) of a given row of the
+   population. It only reads the cache, so the row must have been evaluated
+*/
+
+float fitness(const config * c, const population * p, int row){
+   return p->score[row] / c->obj->max_score;
+}
+
+
+/*
+   Function to print the population matrix with the fitness corresponding to
+   each of the words, in the order of p->order. That is from the fittest to
+   the least fit only after a full sort: a partial ranking (see
+   rank_population()) only splits the rows at the cuts or brings the fittest
+   one first, and the first generation is printed in the order of its rows.
+   Every row is formatted in a buffer, a whole word of genes at a time, and
+   written at once
+*/
+
+void print_population (const config * c, const population * p){
+   char * line = malloc((size_t) c->g_size + 32);
+   int i,j,k;
+   if (line == NULL){
+      return;
+   }
+   for (i=0;i<c->p_size;i++){
+      int row = p->order[i];
+      const word_t * genome = row_genome(c, p, row);
+      for (j=0;j<c->g_words;j++){
+         word_t w = genome[j];
+         int n = c->g_size - j * WORD_BITS;
+         char * out = line + j * WORD_BITS;
+         if (n > WORD_BITS){
+            n = WORD_BITS;
+         }
+         for (k=0;k<n;k++){
+            out[k] = (char) ('0' + ((w >> k) & 1));
+         }
+      }
+      int len = c->g_size + snprintf(line + c->g_size, 32, " f=%.4f\n",
+                                     fitness(c,p,row));
+      fwrite(line, 1, (size_t) len, stdout);
+   }
+   free(line);
+}
+
+
+/*
+   Function to write the population to a file in hexadecimal, in the order
+   of p->order as print_population(): one row per line, the g_words words
+   of the genome from the first one (genes 0 to 63) to the last, 16 digits
+   each with the most significant first, followed by the score. Returns 0
+   on success and 1 on failure
+*/
+
+int dump_population(const config * c, const population * p,
+                    const char * path){
+   static const char hex[] = "0123456789abcdef";
+   FILE * f = fopen(path, "w");
+   char * line = malloc((size_t) c->g_words * 16 + 32);
+   int i,j,k;
+   int err = 0;
+   if (f == NULL || line == NULL){
+      if (f != NULL){
+         fclose(f);
+      }
+      free(line);
+      return 1;
+   }
+   for (i=0;i<c->p_size && !err;i++){
+      int row = p->order[i];
+      const word_t * genome = row_genome(c, p, row);
+      char * out = line;
+      for (j=0;j<c->g_words;j++){
+         for (k=15;k>=0;k--){
+            *out++ = hex[(genome[j] >> (k * 4)) & 0xf];
+         }
+      }
+      out += snprintf(out, 32, " %g\n", p->score[row]);
+      err = fwrite(line, 1, (size_t) (out - line), f) != (size_t) (out - line);
+   }
+   free(line);
+   err |= fclose(f) != 0;
+   return err;
+}
+
+
+/*
+   The allele counters of a population, the number of words carrying a one
+   at every gene. count_alleles counts them from scratch, which is only
+   needed for a new population. From then on they are updated with the
+   difference between the words that leave the population and the words
+   that replace them, bit by bit over the genes where the two differ only,
+   so a converged population costs little more than comparing the words:
+   update_alleles does it for a whole generation, before the buffers of
+   next_generation are swapped (the rows of order[e..] are dropped and
+   replaced by the offspring), and replace_alleles for one row. The genes
+   are split across the threads in blocks of ALIGN_WORDS words, so that no
+   two threads ever touch the same counter
+*/
+
+static inline void add_alleles(int * alleles, word_t old, word_t new){
+   word_t x = old ^ new;
+   while (x){
+      int k = __builtin_ctzll(x);
+      alleles[k] += (int) ((new >> k) & 1) * 2 - 1;
+      x &= x - 1;
+   }
+}
+
+static void tally_alleles(const config * c, population * p,
+                          const word_t * rows, int first, int replace){
+   int block = (int) ALIGN_WORDS;
+   int i;
+   #pragma omp parallel for num_threads(c->threads) schedule(static)
+   for (i=0;i<c->stride/block;i++){
+      int lo = i * block;
+      int hi = lo + block < c->g_words ? lo + block : c->g_words;
+      int j,k;
+      for (k=first;k<c->p_size;k++){
+         const word_t * genome = rows + (size_t) k * c->stride;
+         const word_t * old = replace ? row_genome(c, p, p->order[k]) : NULL;
+         for (j=lo;j<hi;j++){
+            add_alleles(p->alleles + (size_t) j * WORD_BITS,
+                        old != NULL ? old[j] : 0, genome[j]);
+         }
+      }
+   }
+}
+
+void count_alleles(const config * c, population * p){
+   memset(p->alleles, 0, (size_t) c->g_words * WORD_BITS * sizeof(int));
+   tally_alleles(c, p, p->genome, 0, 0);
+}
+
+void update_alleles(const config * c, population * p){
+   int e = c->p_size - c->offspring;
+   if (e == 0){
+      memset(p->alleles, 0, (size_t) c->g_words * WORD_BITS * sizeof(int));
+   }
+   tally_alleles(c, p, p->next, e, e > 0);
+}
+
+void replace_alleles(const config * c, population * p, const word_t * old,
+                     const word_t * genome){
+   int j;
+   for (j=0;j<c->g_words;j++){
+      add_alleles(p->alleles + (size_t) j * WORD_BITS, old[j], genome[j]);
+   }
+}
+
+
+/*
+   Function to compute the diversity of a population from its allele
+   counters, in O(g_size): the mean Hamming distance between two different
+   words divided by g_size, which is 0 for a population of copies of one
+   word and about 1/2 for a random one. If "entropy" is not NULL the mean
+   Shannon entropy of the genes, in bits, is also written to it (0 when
+   every gene is fixed, 1 when every gene is half ones). Returns 0 if the
+   counters are not kept
+*/
+
+double population_diversity(const config * c, const population * p,
+                            double * entropy){
+   double pairs = 0;
+   double h = 0;
+   int j;
+   if (!c->alleles){
+      return 0;
+   }
+   for (j=0;j<c->g_size;j++){
+      double ones = p->alleles[j];
+      pairs += ones * (c->p_size - ones);
+      if (entropy != NULL && ones > 0 && ones < c->p_size){
+         double f = ones / c->p_size;
+         h -= f * log2(f) + (1 - f) * log2(1 - f);
+      }
+   }
+   if (entropy != NULL){
+      *entropy = h / c->g_size;
+   }
+   return 2 * pairs / ((double) c->p_size * (c->p_size - 1) * c->g_size);
+}
+
+
+/*
+   The statistics of a run, written as CSV to a fully buffered stream with
+   one line per generation: the generation, the best score, the mean and
+   the variance of the scores, and the diversity and entropy of the
+   population (see population_diversity())
+*/
+#define STATS_BUFFER (1 << 20)
+
+typedef struct {
+   FILE * f;
+} stats_sink;
+
+int open_stats(const config * c, stats_sink * s, int append){
+   if (strcmp(c->stats, "-") == 0){
+      s->f = stdout;
+   }else{
+      s->f = fopen(c->stats, append ? "a" : "w");
+   }
+   if (s->f == NULL){
+      return 1;
+   }
+   if (s->f != stdout){
+      setvbuf(s->f, NULL, _IOFBF, STATS_BUFFER);
+   }
+   if (!append){
+      fprintf(s->f, "generation,best,mean,variance,diversity,entropy\n");
+   }
+   return 0;
+}
+
+void population_stats(const config * c, const population * p,
+                      int generation, ga_stats * out){
+   double sum = 0, sum2 = 0;
+   int i;
+   for (i=0;i<c->p_size;i++){
+      sum += p->score[i];
+      sum2 += (double) p->score[i] * p->score[i];
+   }
+   double mean = sum / c->p_size;
+   double variance = sum2 / c->p_size - mean * mean;
+   out->generation = generation;
+   out->best = p->score[p->best];
+   out->mean = mean;
+   out->variance = variance > 0 ? variance : 0;
+   out->entropy = 0;
+   out->diversity = population_diversity(c, p, &out->entropy);
+}
+
+void write_stats(const config * c, stats_sink * s, const population * p,
+                 int generation){
+   ga_stats st;
+   population_stats(c, p, generation, &st);
+   fprintf(s->f, "%i,%g,%.6g,%.6g,%.6g,%.6g\n", st.generation, st.best,
+           st.mean, st.variance, st.diversity, st.entropy);
+}
+
+int close_stats(stats_sink * s){
+   int err = 0;
+   if (s->f == stdout){
+      err = fflush(stdout) != 0;
+   }else{
+      err = fclose(s->f) != 0;
+   }
+   return err;
+}
+
+
+/*
+   Function to copy the genes [from, to) of a packed genome into another one,
+   leaving the rest of the destination untouched. The whole words in between
+   are copied with memcpy, and only the words at both ends, which hold genes
+   of the two genomes, are blended with a mask
+*/
+
+void copy_genes(word_t * dst, const word_t * src, int from, int to){
+   if (from >= to){
+      return;
+   }
+   int w1 = from / WORD_BITS;
+   int w2 = (to - 1) / WORD_BITS;
+   word_t m1 = ~(word_t) 0 << (from % WORD_BITS);
+   word_t m2 = ~(word_t) 0 >> (WORD_BITS - 1 - (to - 1) % WORD_BITS);
+   if (w1 == w2){
+      word_t m = m1 & m2;
+      dst[w1] = (dst[w1] & ~m) | (src[w1] & m);
+      return;
+   }
+   dst[w1] = (dst[w1] & ~m1) | (src[w1] & m1);
+   memcpy(dst + w1 + 1, src + w1 + 1,
+          (size_t) (w2 - w1 - 1) * sizeof(word_t));
+   dst[w2] = (dst[w2] & ~m2) | (src[w2] & m2);
+}
+
+
+/*
+   Function to count the ones among the genes [from, to) of a packed genome,
+   masking the words at both ends
+*/
+
+int count_genes(const word_t * genome, int from, int to){
+   if (from >= to){
+      return 0;
+   }
+   int w1 = from / WORD_BITS;
+   int w2 = (to - 1) / WORD_BITS;
+   word_t m1 = ~(word_t) 0 << (from % WORD_BITS);
+   word_t m2 = ~(word_t) 0 >> (WORD_BITS - 1 - (to - 1) % WORD_BITS);
+   if (w1 == w2){
+      return __builtin_popcountll(genome[w1] & m1 & m2);
+   }
+   return __builtin_popcountll(genome[w1] & m1) +
+          count_ones(genome + w1 + 1, w2 - w1 - 1) +
+          __builtin_popcountll(genome[w2] & m2);
+}
+
+
+/*
+   Function to do a crossover between two parents generating two descendants.
+   The pointers to the population matrix lines corresponding to the parents and
+   "dying" words must be given as arguments, along with the number of words in
+   a genome and an integer which corresponds to the point where the crossover
+   happens. Whole words are copied at each side of the crossover point, and
+   the word containing it is blended with a mask. Genomes of FIXED_WORDS
+   words go through the segment kernel instead, which blends every word
+   with a mask computed from the point, unrolled and without a branch.
+   All the crossover functions return the number of ones offspring1 has more
+   than parent1, which is also the number of ones offspring2 has less than
+   parent2, if "delta" is not NULL. It is counted over the swapped genes only,
+   while they are still in cache
+*/
+
+void crossover(const word_t * parent1, const word_t * parent2,
+               word_t * offspring1, word_t * offspring2, int n, int c_point,
+               int * delta){
+   int end = n * WORD_BITS;
+   if (fixed_words(n)){
+      int d = kernels->segment(parent1, parent2, offspring1, offspring2, n,
+                               c_point, end);
+      if (delta != NULL){
+         *delta = d;
+      }
+      return;
+   }
+   copy_genes(offspring1, parent1, 0, c_point);
+   copy_genes(offspring1, parent2, c_point, end);
+   copy_genes(offspring2, parent2, 0, c_point);
+   copy_genes(offspring2, parent1, c_point, end);
+   if (delta != NULL){
+      *delta = count_genes(parent2, c_point, end) -
+               count_genes(parent1, c_point, end);
+   }
+}
+
+
+/*
+   Function to do a two points crossover: the genes [c_point1, c_point2) are
+   swapped between the parents, and the rest is inherited as is
+*/
+
+void crossover_two_point(const word_t * parent1, const word_t * parent2,
+                         word_t * offspring1, word_t * offspring2, int n,
+                         int c_point1, int c_point2, int * delta){
+   int end = n * WORD_BITS;
+   if (fixed_words(n)){
+      int d = kernels->segment(parent1, parent2, offspring1, offspring2, n,
+                               c_point1, c_point2);
+      if (delta != NULL){
+         *delta = d;
+      }
+      return;
+   }
+   copy_genes(offspring1, parent1, 0, c_point1);
+   copy_genes(offspring1, parent2, c_point1, c_point2);
+   copy_genes(offspring1, parent1, c_point2, end);
+   copy_genes(offspring2, parent2, 0, c_point1);
+   copy_genes(offspring2, parent1, c_point1, c_point2);
+   copy_genes(offspring2, parent2, c_point2, end);
+   if (delta != NULL){
+      *delta = count_genes(parent2, c_point1, c_point2) -
+               count_genes(parent1, c_point1, c_point2);
+   }
+}
+
+
+/*
+   Function to do a uniform crossover: every gene is taken from either parent
+   with the same probability. A random mask word is drawn for every word of
+   the genome, offspring1 takes the genes of parent1 where the mask is set and
+   offspring2 the complementary ones. The masks are drawn BLEND_CHUNK words
+   at a time, and each chunk is blended by the kernel
+*/
+#define BLEND_CHUNK 64
+
+void crossover_uniform(const word_t * parent1, const word_t * parent2,
+                       word_t * offspring1, word_t * offspring2, int n,
+                       rng_t * r, int * delta){
+   word_t masks[BLEND_CHUNK];
+   int d = 0;
+   int j,k;
+   for (j=0;j<n;j+=BLEND_CHUNK){
+      int len = n - j < BLEND_CHUNK ? n - j : BLEND_CHUNK;
+      for (k=0;k<len;k++){
+         masks[k] = rng_next(r);
+      }
+      d += kernels->blend(parent1 + j, parent2 + j, offspring1 + j,
+                          offspring2 + j, masks, len);
+   }
+   if (delta != NULL){
+      *delta = d;
+   }
+}
+
+
+/*
+   Function to apply bit-flip mutation to a genome: every gene is flipped with
+   probability c->mutation_rate. Instead of one draw per gene, the gap to the
+   next flipped gene is drawn from the geometric distribution, so the cost is
+   proportional to the number of flips and not to g_size. Returns the change
+   in the number of ones
+*/
+
+int mutate(const config * c, word_t * genome, rng_t * r){
+   int delta = 0;
+   double j = -1;
+   for (;;){
+      j += 1 + floor(log(rng_unit(r)) / c->mutation_log);
+      if (j >= c->g_size){
+         break;
+      }
+      int gene = (int) j;
+      word_t bit = (word_t) 1 << (gene % WORD_BITS);
+      delta += (genome[gene / WORD_BITS] & bit) ? -1 : 1;
+      genome[gene / WORD_BITS] ^= bit;
+   }
+   return delta;
+}
+
+
+/*
+   Function to produce two descendants with the crossover operator chosen in
+   the configuration, drawing the crossover points (or masks) from the given
+   stream of random numbers. "delta" is passed on to the operator
+*/
+
+void reproduce(const config * c, const word_t * parent1,
+               const word_t * parent2, word_t * offspring1,
+               word_t * offspring2, rng_t * r, int * delta){
+   switch (c->crossover_type){
+      case CROSSOVER_TWO_POINT: {
+         int c1 = (int) rng_below(r, (uint32_t) c->g_size + 1);
+         int c2 = (int) rng_below(r, (uint32_t) c->g_size + 1);
+         if (c1 > c2){
+            int temp = c1;
+            c1 = c2;
+            c2 = temp;
+         }
+         crossover_two_point(parent1, parent2, offspring1, offspring2,
+                             c->g_words, c1, c2, delta);
+         break;
+      }
+      case CROSSOVER_UNIFORM:
+         crossover_uniform(parent1, parent2, offspring1, offspring2,
+                           c->g_words, r, delta);
+         break;
+      default:
+         crossover(parent1, parent2, offspring1, offspring2, c->g_words,
+                   (int) rng_below(r, (uint32_t) c->g_size), delta);
+         break;
+   }
+}
+
+
+/*
+   Functions to rank the words in the population according to their respective
+   fitness. Only the ranking in p->order is rewritten, the genomes stay in
+   their rows. With counting_sort, and a fitness function with integer
+   levels, the rows are bucketed by their score, which takes
+   O(p_size + levels); otherwise an array of (fitness, row) keys is sorted
+   with Quicksort, and "comp" is used internally to compare two keys. Ties
+   keep the rows in increasing order in both cases
+*/
+
+int comp(const void *a, const void *b){
+   const fkey * ka = (const fkey *)a;
+   const fkey * kb = (const fkey *)b;
+   if (verbose){
+      printf ("%g vs %g\n",ka->score,kb->score);
+   }
+   if (ka->score == kb->score){
+      return ka->row - kb->row;
+   }else if (ka->score < kb->score){
+      return 1;
+   }else{
+      return -1;
+   }
+}
+
+void sort_P_by_fitness(const config * c, population * p){
+   int i;
+   if (c->counting_sort && c->obj->levels > 0){
+      int * start = p->buckets;
+      for (i=0;i<=c->obj->levels;i++){
+         start[i] = 0;
+      }
+      for (i=0;i<c->p_size;i++){
+         start[(int) p->score[i]]++;
+      }
+      /* Turn the counts into the first rank of each bucket, fittest first */
+      int next = 0;
+      for (i=c->obj->levels;i>=0;i--){
+         int n = start[i];
+         start[i] = next;
+         next += n;
+      }
+      for (i=0;i<c->p_size;i++){
+         p->order[start[(int) p->score[i]]++] = i;
+      }
+   }else{
+      fkey * keys = p->keys;
+      for (i=0;i<c->p_size;i++){
+         keys[i].score = p->score[i];
+         keys[i].row = i;
+      }
+      qsort(keys, c->p_size, sizeof(fkey), comp);
+      for (i=0;i<c->p_size;i++){
+         p->order[i] = keys[i].row;
+      }
+   }
+}
+
+
+/*
+   Function to rearrange an array of keys so that keys[k] ends up where a full
+   sort would have put it, every key before it ranking higher and every key
+   after it ranking lower. It is an iterative version of Hoare's quickselect
+   restricted to keys[lo..hi], and takes O(hi-lo) on average
+*/
+
+void quickselect(fkey * keys, int lo, int hi, int k){
+   while (hi > lo){
+      fkey pivot = keys[lo + (hi-lo)/2];
+      int i = lo;
+      int j = hi;
+      while (i <= j){
+         while (comp(&keys[i], &pivot) < 0){
+            i++;
+         }
+         while (comp(&keys[j], &pivot) > 0){
+            j--;
+         }
+         if (i <= j){
+            fkey temp = keys[i];
+            keys[i] = keys[j];
+            keys[j] = temp;
+            i++;
+            j--;
+         }
+      }
+      if (k <= j){
+         hi = j;
+      }else if (k >= i){
+         lo = i;
+      }else{
+         return;
+      }
+   }
+}
+
+
+/*
+   Function to split the population at the selection cuts without sorting
+   it, for partition. Afterwards the first bottleneck entries of p->order are
+   the fittest rows (the parents), with the fittest of all at p->order[0],
+   and the first p_size - offspring entries are the rows carried over to the
+   next generation, which is exactly what next_generation reads. There is no
+   order inside each block. Two quickselects over the (fitness, row) keys,
+   the second one restricted to the block above the larger cut, take
+   O(p_size) on average
+*/
+
+void partition_P_by_fitness(const config * c, population * p){
+   fkey * keys = p->keys;
+   int b = c->bottleneck;
+   int e = c->p_size - c->offspring;
+   int lo = b < e ? b : e;
+   int hi = b < e ? e : b;
+   int i;
+   for (i=0;i<c->p_size;i++){
+      keys[i].score = p->score[i];
+      keys[i].row = i;
+   }
+   if (hi < c->p_size){
+      quickselect(keys, 0, c->p_size-1, hi-1);
+   }
+   if (lo > 0 && lo < hi){
+      quickselect(keys, 0, hi-1, lo-1);
+   }else{
+      lo = hi;
+   }
+   int best = 0;
+   for (i=1;i<lo;i++){
+      if (comp(&keys[i], &keys[best]) < 0){
+         best = i;
+      }
+   }
+   fkey temp = keys[0];
+   keys[0] = keys[best];
+   keys[best] = temp;
+   for (i=0;i<c->p_size;i++){
+      p->order[i] = keys[i].row;
+   }
+}
+
+
+/*
+   Function to only bring the fittest row, which is already known, to
+   p->order[0], leaving the rest of the rows in their natural order. It is
+   all a generational run with tournament or roulette selection needs
+*/
+
+void best_P_by_fitness(const config * c, population * p){
+   int i;
+   for (i=0;i<c->p_size;i++){
+      p->order[i] = i;
+   }
+   p->order[0] = p->best;
+   p->order[p->best] = 0;
+}
+
+
+/*
+   Function to rank the population as much as the selection needs it: either
+   a full sort or, with partition, only the bottleneck cuts. Tournament and
+   roulette selection never look at the ranking beyond the rows carried over
+   and, with islands, the migrants, so they only need the cuts, or just the
+   best row when the whole population is replaced
+*/
+
+void rank_population(const config * c, population * p){
+   double t = phase_start(c);
+   if (c->selection != SELECTION_TRUNCATION){
+      if (c->offspring == c->p_size && c->islands == 1){
+         best_P_by_fitness(c, p);
+      }else{
+         partition_P_by_fitness(c, p);
+      }
+   }else if (c->partition){
+      partition_P_by_fitness(c, p);
+   }else{
+      sort_P_by_fitness(c, p);
+   }
+   phase_end(c, p, PHASE_RANK, t);
+}
+
+
+/*
+   Randomly shuffle an array. This function is an implementation of the
+   modern version of the Fisher-Yates shuffle
+*/
+
+void shuffle_array(rng_t * r, int * a, int n){
+   int i;
+   for (i=n-1;i>0;i--){
+      int j = (int) rng_below(r, (uint32_t) (i+1));
+      int temp = a[j];
+      a[j] = a[i];
+      a[i] = temp;
+    }
+}
+
+
+/*
+   Function to draw the winner of a tournament: the fittest of
+   c->tournament_size rows drawn at random with replacement
+*/
+
+int tournament(const config * c, const population * p, rng_t * r){
+   int best = (int) rng_below(r, (uint32_t) c->p_size);
+   int k;
+   for (k=1;k<c->tournament_size;k++){
+      int row = (int) rng_below(r, (uint32_t) c->p_size);
+      if (p->score[row] > p->score[best]){
+         best = row;
+      }
+   }
+   return best;
+}
+
+
+/*
+   Function to build the alias table of the roulette selection, where every
+   row is drawn with a probability proportional to its score, in O(p_size)
+   with Vose's method. The scaled probabilities are kept in p->keys, the rows
+   below the average score growing from the front and the ones above it from
+   the back. A callback of the library can return negative scores, so when
+   there are any every score is shifted up by the lowest one first (which is
+   then never drawn). If every score is 0 the draws are uniform
+*/
+
+void build_alias(const config * c, population * p){
+   fkey * keys = p->keys;
+   double total = 0;
+   float base = 0;
+   int small = 0;
+   int large = c->p_size;
+   int i;
+   for (i=0;i<c->p_size;i++){
+      if (p->score[i] < base){
+         base = p->score[i];
+      }
+   }
+   for (i=0;i<c->p_size;i++){
+      total += p->score[i] - base;
+   }
+   for (i=0;i<c->p_size;i++){
+      fkey k;
+      k.score = total > 0 ?
+                (float) ((p->score[i] - base) * c->p_size / total) : 1;
+      k.row = i;
+      if (k.score < 1){
+         keys[small++] = k;
+      }else{
+         keys[--large] = k;
+      }
+   }
+   while (small > 0 && large < c->p_size){
+      fkey s = keys[--small];
+      fkey * l = &keys[large];
+      p->alias[s.row].prob = s.score;
+      p->alias[s.row].alias = l->row;
+      l->score -= 1 - s.score;
+      if (l->score < 1){
+         keys[small++] = *l;
+         large++;
+      }
+   }
+   /* Whatever is left is 1 up to the rounding errors */
+   while (small > 0){
+      p->alias[keys[--small].row].prob = 1;
+   }
+   for (;large<c->p_size;large++){
+      p->alias[keys[large].row].prob = 1;
+   }
+}
+
+
+/*
+   Function to draw a row from the alias table in O(1)
+*/
+
+int roulette(const config * c, const population * p, rng_t * r){
+   int row = (int) rng_below(r, (uint32_t) c->p_size);
+   if (rng_unit(r) <= p->alias[row].prob){
+      return row;
+   }
+   return p->alias[row].alias;
+}
+
+
+/*
+   Function to choose one parent with tournament or roulette selection
+*/
+
+int select_parent(const config * c, const population * p, rng_t * r){
+   if (c->selection == SELECTION_TOURNAMENT){
+      return tournament(c, p, r);
+   }
+   return roulette(c, p, r);
+}
+
+
+/*
+   Function to bring the population through a generation cycle. With
+   truncation selection, the top fittest words (defined by bottleneck) in the
+   population are randomly crossovered in pairs in order to give raise to the
+   progeny; with tournament or roulette selection every parent is drawn on its
+   own by the thread breeding it. The offspring will substitute the bottom
+   words in the population. The rows are looked up through the ranking, so
+   the population must have been ranked beforehand.
+   The next generation is written into the second buffer: its first
+   p_size - offspring rows are copies of the fittest words, cached fitness
+   included, and the rest are the offspring, which are evaluated together in
+   one batch per thread at the end (or, with incremental evaluation, get the
+   score of their parents corrected by the crossover and the mutations). When
+   more offspring than parents are needed the parents are shuffled again for
+   every round. Since nothing of the current generation is overwritten, any
+   number of offspring can be bred and every row of the next generation is
+   written independently. The shuffles draw from the first stream of random
+   numbers, and the copies and crossovers are split across the threads each
+   drawing from its own stream. The fittest row of the next generation is
+   either the first one, a copy of the fittest of this generation, or the
+   fittest offspring. The parents and the alias table are taken from the
+   scratch of the arena, reset first, and the allele counters, when kept,
+   are updated with the offspring
+*/
+
+void next_generation (const config * c, population * p, rng_t * r){
+   int * fittest;
+   int b = c->bottleneck;
+   int e = c->p_size - c->offspring;
+   int incremental = c->incremental && c->obj->incremental;
+   int truncation = c->selection == SELECTION_TRUNCATION;
+   int best = -1;
+   int i;
+   double t = phase_start(c);
+   arena_reset(&p->mem);
+   p->parents = fittest = arena_alloc(&p->mem, selection_bytes(c));
+   p->alias = (alias_t *) p->parents;
+   if (truncation){
+      for (i=0;i<c->offspring;i+=b){
+         memcpy(fittest + i, p->order, (size_t) b * sizeof(int));
+         shuffle_array(r, fittest + i, b);
+      }
+   }else if (c->selection == SELECTION_ROULETTE){
+      build_alias(c, p);
+   }
+   t = phase_end(c, p, PHASE_SELECT, t);
+
+   #pragma omp parallel num_threads(c->threads) \
+                        if(c->offspring/2 >= c->threads)
+   {
+      word_t * next = p->next;
+      int local = -1;
+      int j;
+      #pragma omp for schedule(static) nowait
+      for (j=0;j<e;j++){
+         int row = p->order[j];
+         memcpy(next + (size_t) j * c->stride, row_genome(c, p, row),
+                (size_t) c->stride * sizeof(word_t));
+         p->next_score[j] = p->score[row];
+      }
+      #pragma omp for schedule(static)
+      for (j=0;j<c->offspring/2;j++){
+         int child1 = e + j*2;
+         int child2 = e + j*2 + 1;
+         word_t * o1 = next + (size_t) child1 * c->stride;
+         word_t * o2 = next + (size_t) child2 * c->stride;
+         rng_t * rt = &r[thread_id()];
+         int parent1, parent2;
+         int delta;
+         int m1 = 0, m2 = 0;
+         if (truncation){
+            parent1 = fittest[j*2];
+            parent2 = fittest[(j*2)+1];
+         }else{
+            parent1 = select_parent(c, p, rt);
+            parent2 = select_parent(c, p, rt);
+         }
+         reproduce(c, row_genome(c, p, parent1), row_genome(c, p, parent2),
+                   o1, o2, rt, incremental ? &delta : NULL);
+         if (c->mutation_rate > 0){
+            m1 = mutate(c, o1, rt);
+            m2 = mutate(c, o2, rt);
+         }
+         if (incremental){
+            p->next_score[child1] = p->score[parent1] + (float) (delta + m1);
+            p->next_score[child2] = p->score[parent2] - (float) (delta - m2);
+            local = fitter(p->next_score, local, child1);
+            local = fitter(p->next_score, local, child2);
+         }
+      }
+      if (incremental){
+         #pragma omp critical
+         best = fitter(p->next_score, best, local);
+      }
+   }
+   if (c->alleles){
+      update_alleles(c, p);
+   }
+   t = phase_end(c, p, PHASE_BREED, t);
+   if (!incremental){
+      best = evaluate_rows(c, p->next, p->next_score, e, c->p_size);
+      phase_end(c, p, PHASE_EVALUATE, t);
+   }
+   p->best = fitter(p->next_score, e > 0 ? 0 : -1, best);
+
+   word_t * genome = p->genome;
+   p->genome = p->next;
+   p->next = genome;
+   float * score = p->score;
+   p->score = p->next_score;
+   p->next_score = score;
+}
+
+
+/*
+   The heaps of the steady-state GA. heap_update moves a row whose score
+   changed up or down to its place, and build_heaps makes both heaps of a
+   population from scratch in O(p_size), which is needed whenever the scores
+   change by other means than steady_generation (a new or resumed
+   population, or the arrival of migrants). It also sets p->best
+*/
+
+static inline int heap_above(const heap * h, const float * score, int a,
+                             int b){
+   int f = fitter(score, a, b);
+   return h->max ? f == a : f == b;
+}
+
+static void heap_swap(heap * h, int i, int j){
+   int a = h->rows[i];
+   int b = h->rows[j];
+   h->rows[i] = b;
+   h->rows[j] = a;
+   h->pos[b] = i;
+   h->pos[a] = j;
+}
+
+static void heap_down(heap * h, const float * score, int i){
+   for (;;){
+      int top = i;
+      int l = 2 * i + 1;
+      int r = l + 1;
+      if (l < h->n && heap_above(h, score, h->rows[l], h->rows[top])){
+         top = l;
+      }
+      if (r < h->n && heap_above(h, score, h->rows[r], h->rows[top])){
+         top = r;
+      }
+      if (top == i){
+         return;
+      }
+      heap_swap(h, i, top);
+      i = top;
+   }
+}
+
+static void heap_up(heap * h, const float * score, int i){
+   while (i > 0 && heap_above(h, score, h->rows[i], h->rows[(i - 1) / 2])){
+      heap_swap(h, i, (i - 1) / 2);
+      i = (i - 1) / 2;
+   }
+}
+
+void heap_update(heap * h, const float * score, int row){
+   int i = h->pos[row];
+   heap_up(h, score, i);
+   heap_down(h, score, h->pos[row]);
+}
+
+void build_heaps(const config * c, population * p){
+   heap * hs[2] = {&p->worst, &p->fittest};
+   int i,k;
+   for (k=0;k<2;k++){
+      heap * h = hs[k];
+      h->n = c->p_size;
+      h->max = k == 1;
+      for (i=0;i<h->n;i++){
+         h->rows[i] = i;
+         h->pos[i] = i;
+      }
+      for (i=h->n/2-1;i>=0;i--){
+         heap_down(h, p->score, i);
+      }
+   }
+   p->best = p->fittest.rows[0];
+}
+
+
+/*
+   Function to run one generation of the steady-state GA: c->offspring/2
+   steps, each breeding two offspring from two parents of the current
+   population and writing them over its two least fit rows, the top of the
+   worst heap and the fitter of its children. The offspring are bred into
+   the first two rows of the second buffer, which is otherwise unused, since
+   the parents may be the very rows they replace, and are scored there,
+   incrementally or in a batch of two. Both heaps are then updated for the
+   two rows replaced, so no step looks at more than O(log p_size) rows
+   besides the ones drawn by the selection. The whole generation draws from
+   the first stream of random numbers. The population is not ranked: rank
+   it before looking at p->order. steady_parent, breed_pair and
+   steady_replace are the three parts of a step, shared with
+   async_generation
+*/
+
+static int steady_parent(const config * c, const population * p,
+                         rng_t * r){
+   if (c->selection == SELECTION_TOURNAMENT){
+      return tournament(c, p, r);
+   }
+   return (int) rng_below(r, (uint32_t) c->p_size);
+}
+
+static void breed_pair(const config * c, const population * p, rng_t * r,
+                       int parent1, int parent2, word_t * children,
+                       float * score){
+   word_t * o1 = children;
+   word_t * o2 = children + c->stride;
+   int delta;
+   int m1 = 0, m2 = 0;
+   reproduce(c, row_genome(c, p, parent1), row_genome(c, p, parent2),
+             o1, o2, r, score != NULL ? &delta : NULL);
+   if (c->mutation_rate > 0){
+      m1 = mutate(c, o1, r);
+      m2 = mutate(c, o2, r);
+   }
+   if (score != NULL){
+      score[0] = p->score[parent1] + (float) (delta + m1);
+      score[1] = p->score[parent2] - (float) (delta - m2);
+   }
+}
+
+static void steady_replace(const config * c, population * p,
+                           const word_t * children, const float * score){
+   heap * w = &p->worst;
+   int rows[2];
+   int k;
+   rows[0] = w->rows[0];
+   rows[1] = w->n > 2 && heap_above(w, p->score, w->rows[2], w->rows[1]) ?
+             w->rows[2] : w->rows[1];
+   for (k=0;k<2;k++){
+      word_t * genome = row_genome(c, p, rows[k]);
+      const word_t * child = children + (size_t) k * c->stride;
+      if (c->alleles){
+         replace_alleles(c, p, genome, child);
+      }
+      memcpy(genome, child, (size_t) c->stride * sizeof(word_t));
+      p->score[rows[k]] = score[k];
+      heap_update(&p->worst, p->score, rows[k]);
+      heap_update(&p->fittest, p->score, rows[k]);
+   }
+   p->best = p->fittest.rows[0];
+}
+
+void steady_generation(const config * c, population * p, rng_t * r){
+   int incremental = c->incremental && c->obj->incremental;
+   int s;
+   for (s=0;s<c->offspring/2;s++){
+      double t = phase_start(c);
+      int parent1 = steady_parent(c, p, r);
+      int parent2 = steady_parent(c, p, r);
+      t = phase_end(c, p, PHASE_SELECT, t);
+      breed_pair(c, p, r, parent1, parent2, p->next,
+                 incremental ? p->next_score : NULL);
+      t = phase_end(c, p, PHASE_BREED, t);
+      if (!incremental){
+         evaluate_genomes(c, p->next, 2, p->next_score);
+         t = phase_end(c, p, PHASE_EVALUATE, t);
+      }
+      steady_replace(c, p, p->next, p->next_score);
+      phase_end(c, p, PHASE_RANK, t);
+   }
+}
+
+
+/*
+   Bounded lock-free multi-producer multi-consumer queue of ints, Vyukov's
+   design: every cell carries a sequence number telling whether it is free
+   for the producer of position "pos" (seq == pos) or holds the value for
+   its consumer (seq == pos + 1). Producers and consumers only contend on
+   their own end, claimed with a CAS, and the value is published with the
+   release store of the sequence number. The capacity is a power of 2.
+   mpmc_push returns 1 if the queue is full and mpmc_pop 1 if it is empty,
+   0 on success
+*/
+
+void mpmc_init(mpmc_queue * q, mpmc_cell * cells, size_t capacity){
+   size_t i;
+   q->cells = cells;
+   q->mask = capacity - 1;
+   for (i=0;i<capacity;i++){
+      atomic_init(&cells[i].seq, i);
+   }
+   atomic_init(&q->head, 0);
+   atomic_init(&q->tail, 0);
+}
+
+int mpmc_push(mpmc_queue * q, int value){
+   size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+   mpmc_cell * cell;
+   for (;;){
+      cell = &q->cells[pos & q->mask];
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+      intptr_t dif = (intptr_t) seq - (intptr_t) pos;
+      if (dif == 0){
+         if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed)){
+            break;
+         }
+      }else if (dif < 0){
+         return 1;
+      }else{
+         pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+      }
+   }
+   cell->value = value;
+   atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+   return 0;
+}
+
+int mpmc_pop(mpmc_queue * q, int * value){
+   size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+   mpmc_cell * cell;
+   for (;;){
+      cell = &q->cells[pos & q->mask];
+      size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+      intptr_t dif = (intptr_t) seq - (intptr_t) (pos + 1);
+      if (dif == 0){
+         if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed)){
+            break;
+         }
+      }else if (dif < 0){
+         return 1;
+      }else{
+         pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+      }
+   }
+   *value = cell->value;
+   atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+   return 0;
+}
+
+/* Waits a little while spinning on a queue, yielding the core once idle */
+static inline void backoff(int * idle){
+   if (++*idle < 64){
+#ifdef GA_X86_KERNELS
+      _mm_pause();
+#endif
+   }else{
+      sched_yield();
+   }
+}
+
+
+/*
+   Function to run one generation of the asynchronous steady-state GA: the
+   same c->offspring births as steady_generation, but the offspring are
+   evaluated by the other c->threads - 1 threads while the first one keeps
+   breeding, so a slow evaluation only holds back its own pair. Every pair
+   is bred into a slot of two rows of the second buffer (async_slots(c) of
+   them) whose number is pushed to the "work" queue. The evaluators pop it,
+   score both rows and push it to the "done" queue, from which the first
+   thread takes the pairs as they complete, in any order, writes them over
+   the least fit rows and breeds the next pair into the slot freed. When the
+   pipeline is full and nothing has completed the first thread evaluates a
+   pair itself. All the pairs bred are in the population before returning,
+   so nothing is in flight between generations. Since the pairs come back
+   in the order their evaluations end, a run with more than one thread does
+   not depend on the seed only. The offspring are always evaluated in full
+*/
+
+int async_slots(const config * c){
+   int slots = 2 * c->threads;
+   return slots < c->p_size / 2 ? slots : c->p_size / 2;
+}
+
+static size_t async_capacity(const config * c){
+   size_t capacity = 1;
+   while (capacity < (size_t) async_slots(c)){
+      capacity *= 2;
+   }
+   return capacity;
+}
+
+size_t async_bytes(const config * c){
+   if (!c->async){
+      return 0;
+   }
+   return round_up((size_t) async_slots(c) * sizeof(int), ALIGN_BYTES) +
+          2 * async_capacity(c) * sizeof(mpmc_cell);
+}
+
+static void evaluate_slot(const config * c, population * p, int slot){
+   evaluate_genomes(c, p->next + (size_t) 2 * slot * c->stride, 2,
+                    p->next_score + 2 * slot);
+}
+
+static void async_breeder(const config * c, population * p, rng_t * r,
+                          mpmc_queue * work, mpmc_queue * done,
+                          int * free_slots){
+   int nfree = async_slots(c);
+   int bred = 0, inserted = 0;
+   int idle = 0;
+   int slot;
+   while (inserted < c->offspring){
+      double t = phase_start(c);
+      if (!mpmc_pop(done, &slot)){
+         steady_replace(c, p, p->next + (size_t) 2 * slot * c->stride,
+                        p->next_score + 2 * slot);
+         free_slots[nfree++] = slot;
+         inserted += 2;
+         idle = 0;
+         phase_end(c, p, PHASE_RANK, t);
+      }else if (bred < c->offspring && nfree > 0){
+         int parent1 = steady_parent(c, p, r);
+         int parent2 = steady_parent(c, p, r);
+         t = phase_end(c, p, PHASE_SELECT, t);
+         slot = free_slots[--nfree];
+         breed_pair(c, p, r, parent1, parent2,
+                    p->next + (size_t) 2 * slot * c->stride, NULL);
+         mpmc_push(work, slot);
+         bred += 2;
+         phase_end(c, p, PHASE_BREED, t);
+      }else if (!mpmc_pop(work, &slot)){
+         evaluate_slot(c, p, slot);
+         mpmc_push(done, slot);
+         phase_end(c, p, PHASE_EVALUATE, t);
+      }else{
+         backoff(&idle);
+      }
+   }
+}
+
+void async_generation(const config * c, population * p, rng_t * r){
+   size_t capacity = async_capacity(c);
+   mpmc_queue work, done;
+   atomic_int finished;
+   int k;
+   arena_reset(&p->mem);
+   int * free_slots = arena_alloc(&p->mem,
+                                  (size_t) async_slots(c) * sizeof(int));
+   mpmc_cell * cells = arena_alloc(&p->mem,
+                                   2 * capacity * sizeof(mpmc_cell));
+   for (k=0;k<async_slots(c);k++){
+      free_slots[k] = k;
+   }
+   mpmc_init(&work, cells, capacity);
+   mpmc_init(&done, cells + capacity, capacity);
+   atomic_init(&finished, 0);
+
+   #pragma omp parallel num_threads(c->threads)
+   {
+      if (thread_id() == 0){
+         async_breeder(c, p, r, &work, &done, free_slots);
+         atomic_store_explicit(&finished, 1, memory_order_release);
+      }else{
+         int idle = 0;
+         int slot;
+         while (!atomic_load_explicit(&finished, memory_order_acquire)){
+            if (!mpmc_pop(&work, &slot)){
+               evaluate_slot(c, p, slot);
+               mpmc_push(&done, slot);
+               idle = 0;
+            }else{
+               backoff(&idle);
+            }
+         }
+      }
+   }
+}
+
+
+/*
+   Functions to run any mode of the GA on a population: order_population
+   builds what the next generation selects from, the heaps of the steady
+   state or the ranking, which is needed whenever the scores change by other
+   means than the generations themselves, and breed_population runs one
+   generation (the population stays ranked in the generational GA only)
+*/
+
+void order_population(const config * c, population * p){
+   if (c->steady_state){
+      build_heaps(c, p);
+   }else{
+      rank_population(c, p);
+   }
+}
+
+void breed_population(const config * c, population * p, rng_t * r){
+   if (c->async){
+      async_generation(c, p, r);
+   }else if (c->steady_state){
+      steady_generation(c, p, r);
+   }else{
+      next_generation(c, p, r);
+      rank_population(c, p);
+   }
+}
+
+
+/*
+   The termination of a run. check_stop is called before every generation
+   with the score of the best word and the diversity of the population
+   (only looked at with min_diversity), and returns the reason to stop, or
+   STOP_NONE to go on. It remembers the best score seen and the generation
+   it was first reached to detect the stagnation. The generation g counts
+   from 1, so a maximum of bmax generations stops at g = bmax + 1
+*/
+enum { STOP_NONE, STOP_TARGET, STOP_GENERATIONS, STOP_STAGNATION, STOP_TIME,
+       STOP_DIVERSITY };
+
+static const char * stop_names[] = {
+   "none", "target", "generations", "stagnation", "time", "diversity"
+};
+
+typedef struct {
+   float best;
+   int since;
+   double start;
+} stop_state;
+
+void start_stop(stop_state * s){
+   s->best = -1;
+   s->since = 1;
+   s->start = wall_time();
+}
+
+int out_of_time(const config * c, const stop_state * s){
+   return c->time_limit > 0 && wall_time() - s->start >= c->time_limit;
+}
+
+int check_stop(const config * c, stop_state * s, float best,
+               double diversity, int g){
+   if (best >= c->target_score){
+      return STOP_TARGET;
+   }
+   if (g > c->max_generations){
+      return STOP_GENERATIONS;
+   }
+   if (best > s->best){
+      s->best = best;
+      s->since = g;
+   }else if (c->stagnation > 0 && g - s->since >= c->stagnation){
+      return STOP_STAGNATION;
+   }
+   if (c->min_diversity > 0 && diversity < c->min_diversity){
+      return STOP_DIVERSITY;
+   }
+   if (out_of_time(c, s)){
+      return STOP_TIME;
+   }
+   return STOP_NONE;
+}
+
+
+/*
+   Checkpoints of a run. A checkpoint is a binary file in the native byte
+   order with everything needed to resume the run bit-exactly: a header with
+   the sizes, the generation counter, the state of the stagnation check and
+   the parameters of the GA that shape the run (a resumed run must be given
+   the same ones, they are checked against the header), followed by the
+   state of every stream of random numbers, the cached scores and the genome
+   block, each section starting at a multiple of ALIGN_BYTES. The ranking is
+   not saved, since it only depends on the scores. The genomes are written
+   as the single block they live in, so saving costs little more than
+   copying the population. Checkpoints are written to a temporary file which
+   is then renamed, so a run killed while saving leaves the previous
+   checkpoint intact. They are read back through mmap. Both functions
+   return 0 on success and 1 on failure
+*/
+#define CKPT_MAGIC "GACKPT03"
+
+typedef struct {
+   char magic[8];
+   int32_t g_size;
+   int32_t p_size;
+   int32_t stride;
+   int32_t streams;
+   int32_t generation;
+   int32_t best;
+   int32_t since;
+   float best_score;
+   uint64_t seed;
+   int32_t bottleneck;
+   int32_t offspring;
+   int32_t crossover_type;
+   int32_t selection;
+   int32_t partition;
+   int32_t tournament_size;
+   int32_t steady_state;
+   int32_t async;
+   int32_t objective;
+   double mutation_rate;
+} ckpt_header;
+
+/*
+   Function to fill the parameters of the GA in a checkpoint header, the
+   objective as its position in the "objectives" table
+*/
+
+static void checkpoint_params(const config * c, ckpt_header * h){
+   h->bottleneck = c->bottleneck;
+   h->offspring = c->offspring;
+   h->crossover_type = c->crossover_type;
+   h->selection = c->selection;
+   h->partition = c->partition;
+   h->tournament_size = c->tournament_size;
+   h->steady_state = c->steady_state;
+   h->async = c->async;
+   h->objective = (int32_t) (c->obj - objectives);
+   h->mutation_rate = c->mutation_rate;
+}
+
+/* Offsets of the sections of a checkpoint, and its total size */
+typedef struct {
+   size_t rng;
+   size_t score;
+   size_t genome;
+   size_t size;
+} ckpt_layout;
+
+ckpt_layout checkpoint_layout(const config * c, int streams){
+   ckpt_layout l;
+   l.rng = round_up(sizeof(ckpt_header), ALIGN_BYTES);
+   l.score = round_up(l.rng + (size_t) streams * sizeof(rng_t), ALIGN_BYTES);
+   l.genome = round_up(l.score + (size_t) c->p_size * sizeof(float),
+                       ALIGN_BYTES);
+   l.size = l.genome + (size_t) c->p_size * c->stride * sizeof(word_t);
+   return l;
+}
+
+static int write_all(int fd, const void * buf, size_t n, size_t offset){
+   const char * b = buf;
+   while (n > 0){
+      ssize_t w = pwrite(fd, b, n, (off_t) offset);
+      if (w <= 0){
+         return 1;
+      }
+      b += w;
+      n -= (size_t) w;
+      offset += (size_t) w;
+   }
+   return 0;
+}
+
+int save_checkpoint(const config * c, const population * p, const rng_t * r,
+                    int streams, int g, const stop_state * s,
+                    const char * path){
+   ckpt_layout l = checkpoint_layout(c, streams);
+   ckpt_header h;
+   size_t len = strlen(path);
+   char * tmp = malloc(len + 5);
+   int err = 0;
+   if (tmp == NULL){
+      return 1;
+   }
+   memcpy(tmp, path, len);
+   memcpy(tmp + len, ".tmp", 5);
+
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+   h.g_size = c->g_size;
+   h.p_size = c->p_size;
+   h.stride = c->stride;
+   h.streams = streams;
+   h.generation = g;
+   h.best = p->best;
+   h.since = s->since;
+   h.best_score = s->best;
+   h.seed = c->seed;
+   checkpoint_params(c, &h);
+
+   int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0){
+      free(tmp);
+      return 1;
+   }
+   err |= ftruncate(fd, (off_t) l.size) != 0;
+   err |= write_all(fd, &h, sizeof(h), 0);
+   err |= write_all(fd, r, (size_t) streams * sizeof(rng_t), l.rng);
+   err |= write_all(fd, p->score, (size_t) c->p_size * sizeof(float),
+                    l.score);
+   err |= write_all(fd, p->genome,
+                    (size_t) c->p_size * c->stride * sizeof(word_t),
+                    l.genome);
+   err |= close(fd) != 0;
+   if (!err){
+      err = rename(tmp, path) != 0;
+   }
+   if (err){
+      unlink(tmp);
+   }
+   free(tmp);
+   return err;
+}
+
+int load_checkpoint(config * c, population * p, rng_t * r, int streams,
+                    int * g, stop_state * s, const char * path){
+   ckpt_layout l = checkpoint_layout(c, streams);
+   struct stat st;
+   int fd = open(path, O_RDONLY);
+   if (fd < 0){
+      fprintf(stderr, "Cannot open the checkpoint %s\n", path);
+      return 1;
+   }
+   if (fstat(fd, &st) != 0 || (size_t) st.st_size != l.size){
+      fprintf(stderr, "The checkpoint %s does not match the genome size, "
+                      "population and threads of this run\n", path);
+      close(fd);
+      return 1;
+   }
+   const char * map = mmap(NULL, l.size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED){
+      fprintf(stderr, "Cannot map the checkpoint %s\n", path);
+      return 1;
+   }
+   ckpt_header h;
+   ckpt_header run;
+   int err = 0;
+   memcpy(&h, map, sizeof(h));
+   memset(&run, 0, sizeof(run));
+   checkpoint_params(c, &run);
+   if (memcmp(h.magic, CKPT_MAGIC, sizeof(h.magic)) != 0 ||
+       h.g_size != c->g_size || h.p_size != c->p_size ||
+       h.stride != c->stride || h.streams != streams ||
+       h.best < 0 || h.best >= c->p_size){
+      fprintf(stderr, "The checkpoint %s does not match the genome size, "
+                      "population and threads of this run\n", path);
+      err = 1;
+   }else if (h.bottleneck != run.bottleneck ||
+             h.offspring != run.offspring ||
+             h.crossover_type != run.crossover_type ||
+             h.selection != run.selection ||
+             h.partition != run.partition ||
+             h.tournament_size != run.tournament_size ||
+             h.steady_state != run.steady_state || h.async != run.async ||
+             h.objective != run.objective ||
+             h.mutation_rate != run.mutation_rate){
+      fprintf(stderr, "The checkpoint %s was saved with another bottleneck, "
+                      "offspring, crossover, selection, ranking, mode, "
+                      "mutation rate or fitness function than this run\n",
+              path);
+      err = 1;
+   }else{
+      posix_madvise((void *) map, l.size, POSIX_MADV_SEQUENTIAL);
+      memcpy(r, map + l.rng, (size_t) streams * sizeof(rng_t));
+      memcpy(p->score, map + l.score, (size_t) c->p_size * sizeof(float));
+      memcpy(p->genome, map + l.genome,
+             (size_t) c->p_size * c->stride * sizeof(word_t));
+      p->best = h.best;
+      *g = h.generation;
+      s->since = h.since;
+      s->best = h.best_score;
+      c->seed = h.seed;
+   }
+   munmap((void *) map, l.size);
+   return err;
+}
+
 
-/* 
-   Definition of the constants used in the simulation.
-   - G_SIZE (n) is the length in bits of each computer word.
-   - P_SIZE (m) is the number of words in the population
-   - BOTTLENECK (b) is the number of genomes that survive each generation giving
-     rise to the progeny by crossover
-   - MAX_GENERATIONS (bmax) is the maximum number of generations in the
-     simulation 
+/*
+   Function to print the time spent in every phase, in nanoseconds per
+   organism and generation (per organism for the initialization, which only
+   happens once), for "organisms" words run through "generations"
+   generations in "seconds" seconds of wall time
 */
-#define G_SIZE 16
-#define P_SIZE 40
-#define BOTTLENECK 20
-#define MAX_GENERATIONS 10
+
+void print_profile(const double * phase, double organisms, int generations,
+                   double seconds){
+   int k;
+   printf("Kernels: %s\n", kernels->name);
+   printf("Profile (ns per organism and generation):\n");
+   for (k=0;k<N_PHASES;k++){
+      double n = organisms * (k == PHASE_INIT || generations == 0 ?
+                              1 : generations);
+      printf("   %-9s %10.2f\n", phase_names[k], phase[k] * 1e9 / n);
+   }
+   printf("Generations per second: %.2f\n",
+          seconds > 0 ? generations / seconds : 0);
+}
+
 
 /*
-   Function to generate a random population. It is just a random binary matrix
-   of G_SIZE x P_SIZE (rand() % 2). The matrix must be initialized beforehand,
-   and iven as the argument to the funcion
+   An island of the island model: its population, its block of streams of
+   random numbers (one per thread, like the single population) and its own
+   generation counter
 */
 
-void rand_population(int p[P_SIZE][G_SIZE]) {
-   srand( (unsigned int) time( NULL ));
-   int i,j;
-   for (i=0;i<P_SIZE;i++){
-      for (j=0;j<G_SIZE;j++){
-         p[i][j] = rand() % 2;
+typedef struct {
+   population * p;
+   rng_t * r;
+   int g;
+} island;
+
+
+/*
+   Function to run up to "steps" generations of the GA loop of main on one
+   island, stopping as soon as one of its words reaches the target or the
+   time is up. The island is ranked first, because the migration changes its
+   worst rows. In steady state its heaps are built first instead, and it is
+   only ranked at the end, for the migration
+*/
+
+void evolve_island(const config * c, island * is, int steps,
+                   const stop_state * st){
+   int s;
+   order_population(c, is->p);
+   for (s=0;s<steps && is->p->score[is->p->best] < c->target_score &&
+            !out_of_time(c, st);s++){
+      breed_population(c, is->p, is->r);
+      is->g++;
+   }
+   if (c->steady_state){
+      rank_population(c, is->p);
+   }
+}
+
+
+/*
+   Function to exchange words between the islands, which are arranged in a
+   ring: the best c->migrants words of each island overwrite the worst ones of
+   the next island, cached fitness included. As migrants <= p_size/2, the
+   rows sent and the rows overwritten are always different, so every island
+   can send and receive at the same time. The migrants and the rows they
+   overwrite are ranked exactly first (see rank_migrants()), even when the
+   islands are only partially ranked. The receiving islands must be
+   ranked again afterwards, but their best row and allele counters are
+   updated here.
+   With MPI the ring goes through all the islands of all the ranks in
+   order, so the last island of a rank sends to the first island of the
+   next one. Those migrants travel packed, g_words words per genome
+   followed by its score in one more word, with a non-blocking send and
+   receive posted before the migrations inside the rank, and are only
+   waited for once these are done
+*/
+
+/*
+   Function to rank the words that migrate exactly: the best c->migrants
+   words of an island first and its worst ones last, both in order, which a
+   partial ranking (--partition, tournament and roulette) does not ensure.
+   Both groups are selected with quickselect and then sorted, and the rows
+   between them are left in no particular order
+*/
+
+static void rank_migrants(const config * c, population * p){
+   fkey * keys = p->keys;
+   int m = c->migrants;
+   int n = c->p_size;
+   int i;
+   if (m == 0 || (c->selection == SELECTION_TRUNCATION && !c->partition)){
+      return;
+   }
+   for (i=0;i<n;i++){
+      keys[i].score = p->score[i];
+      keys[i].row = i;
+   }
+   quickselect(keys, 0, n-1, m-1);
+   quickselect(keys, m, n-1, n-m);
+   qsort(keys, m, sizeof(fkey), comp);
+   qsort(keys + n - m, m, sizeof(fkey), comp);
+   for (i=0;i<n;i++){
+      p->order[i] = keys[i].row;
+   }
+}
+
+static void receive_migrant(const config * c, population * to, int k,
+                            const word_t * genome, float score){
+   int dst = to->order[c->p_size-1-k];
+   if (c->alleles){
+      replace_alleles(c, to, row_genome(c, to, dst), genome);
+   }
+   memcpy(row_genome(c, to, dst), genome, (size_t) c->g_words * sizeof(word_t));
+   to->score[dst] = score;
+   to->best = fitter(to->score, to->best, dst);
+}
+
+void migrate(const config * c, island * islands, int n, word_t * buffer){
+   int i,k;
+   int local = n;
+   for (i=0;i<n;i++){
+      rank_migrants(c, islands[i].p);
+   }
+#ifdef GA_MPI
+   size_t words = (size_t) c->migrants * (c->g_words + 1);
+   word_t * out = buffer;
+   word_t * in = buffer + words;
+   MPI_Request req[2];
+   if (mpi_ranks > 1){
+      population * from = islands[n-1].p;
+      for (k=0;k<c->migrants;k++){
+         word_t * m = out + (size_t) k * (c->g_words + 1);
+         int src = from->order[k];
+         memcpy(m, row_genome(c, from, src),
+                (size_t) c->g_words * sizeof(word_t));
+         memcpy(m + c->g_words, &from->score[src], sizeof(float));
+      }
+      MPI_Irecv(in, (int) words, MPI_UINT64_T,
+                (mpi_rank + mpi_ranks - 1) % mpi_ranks, 0, MPI_COMM_WORLD,
+                &req[0]);
+      MPI_Isend(out, (int) words, MPI_UINT64_T, (mpi_rank + 1) % mpi_ranks,
+                0, MPI_COMM_WORLD, &req[1]);
+      local = n - 1;
+   }
+#else
+   (void) buffer;
+#endif
+   for (i=0;i<local;i++){
+      population * from = islands[i].p;
+      population * to = islands[(i+1) % n].p;
+      for (k=0;k<c->migrants;k++){
+         int src = from->order[k];
+         receive_migrant(c, to, k, row_genome(c, from, src),
+                         from->score[src]);
+      }
+   }
+#ifdef GA_MPI
+   if (mpi_ranks > 1){
+      MPI_Waitall(2, req, MPI_STATUSES_IGNORE);
+      for (k=0;k<c->migrants;k++){
+         const word_t * m = in + (size_t) k * (c->g_words + 1);
+         float score;
+         memcpy(&score, m + c->g_words, sizeof(float));
+         receive_migrant(c, islands[0].p, k, m, score);
       }
    }
+#endif
 }
 
 
 /*
-   Function to calculate the fitness (between 0 and 1) of a given binary
-   vector. The pointer to the binary vector is given as argument to the
-   function
+   Function to run the island model. The islands are created and evolved in
+   parallel, one thread each, and only meet at the migration points, where
+   the best word of all is checked for termination (the target and time
+   limit are also checked by each island at every generation). The
+   population of the island holding the best word is printed at the end.
+   Returns 0 on success and 1 if there is not enough memory.
+   With MPI every rank runs c->islands of the islands, the ones numbered
+   from mpi_rank * c->islands on, each with the streams of random numbers
+   it would have in a single process, so a run on N ranks is the same as
+   one of N * c->islands islands in one process. The ranks only wait for
+   each other at the migration points, where the best score (with the
+   island holding it), the diversity and the reason to stop are reduced
+   over all of them, and at the end, when the best island is sent to rank
+   0, which prints everything
 */
 
-float fitness(int * genome){
-   float f=0;
-   int j;
-   for (j=0;j<G_SIZE;j++){
-      f += genome[j];
+int run_islands(const config * c, rng_t * r){
+   int n = c->islands;
+   int first = mpi_rank * n;
+   island * islands = calloc((size_t) n, sizeof(island));
+   word_t * buffer = malloc(2 * (size_t) c->migrants * (c->g_words + 1) *
+                            sizeof(word_t));
+   int i;
+   int status = 0;
+   if (islands == NULL || buffer == NULL){
+      fprintf(stderr, "Not enough memory for the islands\n");
+      free(islands);
+      free(buffer);
+      return 1;
    }
-   f/=G_SIZE;
-   return f;
+   for (i=0;i<n;i++){
+      islands[i].p = new_population(c);
+      islands[i].r = r + (size_t) (first + i) * c->threads;
+      islands[i].g = 1;
+      if (islands[i].p == NULL){
+         status = 1;
+      }
+   }
+   if (status){
+      fprintf(stderr, "Not enough memory for the islands\n");
+   }else{
+      #pragma omp parallel for num_threads(n) schedule(static,1)
+      for (i=0;i<n;i++){
+         rand_population(c, islands[i].p, islands[i].r);
+         evaluate_population(c, islands[i].p);
+         if (c->alleles){
+            count_alleles(c, islands[i].p);
+         }
+      }
+
+      stop_state st;
+      int g = 1;
+      int best = 0;
+      double diversity;
+      int why = STOP_NONE;
+      struct {
+         float score;
+         int island;
+      } top;
+      start_stop(&st);
+      for (;;){
+         int steps = c->max_generations - g + 1;
+         if (steps > c->migration_interval){
+            steps = c->migration_interval;
+         }
+         #pragma omp parallel for num_threads(n) schedule(static,1)
+         for (i=0;i<n;i++){
+            evolve_island(c, &islands[i], steps, &st);
+         }
+         g += steps;
+
+         best = 0;
+         diversity = 0;
+         for (i=0;i<n;i++){
+            population * p = islands[i].p;
+            double d = population_diversity(c, p, NULL);
+            if (p->score[p->best] >
+                islands[best].p->score[islands[best].p->best]){
+               best = i;
+            }
+            if (d > diversity){
+               diversity = d;
+            }
+         }
+         population * bp = islands[best].p;
+         top.score = bp->score[bp->best];
+         top.island = first + best;
+#ifdef GA_MPI
+         if (mpi_ranks > 1){
+            MPI_Allreduce(MPI_IN_PLACE, &top, 1, MPI_FLOAT_INT, MPI_MAXLOC,
+                          MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, &diversity, 1, MPI_DOUBLE, MPI_MAX,
+                          MPI_COMM_WORLD);
+         }
+#endif
+         if (!c->quiet && mpi_rank == 0){
+            printf("Best fitness: %.4f (island %i)\n",
+                   top.score / c->obj->max_score, top.island);
+         }
+         why = check_stop(c, &st, top.score, diversity, g);
+#ifdef GA_MPI
+         if (mpi_ranks > 1){
+            MPI_Allreduce(MPI_IN_PLACE, &why, 1, MPI_INT, MPI_MAX,
+                          MPI_COMM_WORLD);
+         }
+#endif
+         if (why != STOP_NONE){
+            break;
+         }
+         migrate(c, islands, n, buffer);
+      }
+
+      double phase[N_PHASES] = {0};
+      int k;
+      for (i=0;i<n;i++){
+         for (k=0;k<N_PHASES;k++){
+            phase[k] += islands[i].p->phase[k];
+         }
+      }
+      population * bp = islands[best].p;
+      int generations = islands[best].g;
+#ifdef GA_MPI
+      if (mpi_ranks > 1){
+         int owner = top.island / n;
+         population * q = islands[top.island % n].p;
+         if (owner != 0 && (mpi_rank == owner || mpi_rank == 0)){
+            /* The best island, in the population of island 0 of rank 0 */
+            int tag = 1;
+            void * part[] = {&islands[top.island % n].g, q->genome, q->score,
+                             q->order, &q->best};
+            int count[] = {1, c->p_size * c->stride, c->p_size, c->p_size,
+                           1};
+            MPI_Datatype type[] = {MPI_INT, MPI_UINT64_T, MPI_FLOAT, MPI_INT,
+                                   MPI_INT};
+            if (mpi_rank == 0){
+               part[0] = &generations;
+               part[1] = islands[0].p->genome;
+               part[2] = islands[0].p->score;
+               part[3] = islands[0].p->order;
+               part[4] = &islands[0].p->best;
+            }
+            for (k=0;k<5;k++){
+               if (mpi_rank == owner){
+                  MPI_Send(part[k], count[k], type[k], 0, tag, MPI_COMM_WORLD);
+               }else{
+                  MPI_Recv(part[k], count[k], type[k], owner, tag,
+                           MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+               }
+            }
+            bp = islands[0].p;
+         }else{
+            bp = q;
+            generations = islands[top.island % n].g;
+         }
+         MPI_Reduce(mpi_rank == 0 ? MPI_IN_PLACE : phase, phase, N_PHASES,
+                    MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+      }
+#endif
+      if (mpi_rank == 0){
+         if (!c->quiet){
+            print_population(c, bp);
+         }
+         if (c->dump != NULL && dump_population(c, bp, c->dump)){
+            fprintf(stderr, "Cannot write the population to %s\n", c->dump);
+            status = 1;
+         }
+         printf("Island: %i\n",top.island);
+         printf("Generations: %i\n",generations);
+         printf("Stop: %s\n",stop_names[why]);
+         if (c->profile){
+            print_profile(phase, (double) n * mpi_ranks * c->p_size,
+                          generations - 1, wall_time() - st.start);
+         }
+      }
+   }
+
+   for (i=0;i<n;i++){
+      free_population(islands[i].p);
+   }
+   free(islands);
+   free(buffer);
+   return status;
 }
 
 
 /*
-   Function to print the population matrix with the fitness corresponding to
-   each of the words 
+   Function to run the benchmark: fixed seed runs of exactly max_generations
+   generations (no other stop criterion) over a grid of genome sizes,
+   populations and bottlenecks, with every other parameter as given in the
+   configuration. For every point of the grid the time spent in each phase
+   is printed in nanoseconds per organism and generation, along with the
+   generations per second. Returns 0 on success and 1 if a population could
+   not be allocated
 */
 
-void print_population (int p[P_SIZE][G_SIZE]){
-   int i,j;
-   for (i=0;i<P_SIZE;i++){
-      for (j=0;j<G_SIZE;j++){
-         printf ("%i",p[i][j]);
+void derive_config(config * c);
+void derive_sizes(config * c);
+int parse_int(const char * arg, const char * flag, int * out);
+
+int run_benchmark(const config * c, rng_t * r){
+   static const int g_sizes[] = {64, 1024, 4096};
+   static const int p_sizes[] = {1000, 10000, 100000};
+   static const int b_percent[] = {10, 50};
+   int i,j,k,q;
+   int status = 0;
+   printf("Benchmark: %i generations, %i threads, %s kernels, ns per "
+          "organism and generation\n", c->max_generations, c->threads,
+          kernels->name);
+   printf("%6s %8s %7s %10s", "G", "P", "B", "gen/s");
+   for (q=0;q<N_PHASES;q++){
+      printf(" %9s", phase_names[q]);
+   }
+   printf("\n");
+   for (i=0;i<(int) (sizeof(g_sizes)/sizeof(g_sizes[0]));i++){
+      for (j=0;j<(int) (sizeof(p_sizes)/sizeof(p_sizes[0]));j++){
+         for (k=0;k<(int) (sizeof(b_percent)/sizeof(b_percent[0]));k++){
+            config b = *c;
+            int g;
+            b.g_size = g_sizes[i];
+            b.p_size = p_sizes[j];
+            b.bottleneck = p_sizes[j] * b_percent[k] / 100;
+            b.offspring = b.bottleneck;
+            b.profile = 1;
+            derive_config(&b);
+            population * p = new_population(&b);
+            if (p == NULL){
+               fprintf(stderr, "Not enough memory for P = %i, G = %i\n",
+                       b.p_size, b.g_size);
+               status = 1;
+               continue;
+            }
+            rng_streams(r, b.threads, b.seed);
+            rand_population(&b, p, r);
+            evaluate_population(&b, p);
+            if (b.alleles){
+               count_alleles(&b, p);
+            }
+            order_population(&b, p);
+            double start = wall_time();
+            for (g=0;g<b.max_generations;g++){
+               breed_population(&b, p, r);
+            }
+            double seconds = wall_time() - start;
+            printf("%6i %8i %7i %10.2f", b.g_size, b.p_size, b.bottleneck,
+                   seconds > 0 ? b.max_generations / seconds : 0);
+            for (q=0;q<N_PHASES;q++){
+               double n = (double) b.p_size * (q == PHASE_INIT ||
+                          b.max_generations == 0 ? 1 : b.max_generations);
+               printf(" %9.2f", p->phase[q] * 1e9 / n);
+            }
+            printf("\n");
+            fflush(stdout);
+            free_population(p);
+         }
       }
-      printf (" f=%.4f\n",fitness(p[i]));
    }
+   return status;
 }
 
 
 /*
-   Function to do a crossover between two parents generating two descendants.
-   The pointers to the population matrix lines corresponding to the parents and
-   "dying" words must be given as arguments, along with an integer which
-   corresponds to the point where the crossover happens
+   The sweep: independent runs over a grid of genome sizes, populations and
+   bottlenecks, each repeated with several seeds. The grid is given as a
+   list of key=value,value,... items separated by spaces or semicolons, with
+   the keys g, p and b (the bottleneck, which is also the offspring and must
+   be even) and seeds, the number of runs of every point (a single value)
+   with the seeds seed, seed+1, ... Keys left out take the value of the
+   configuration, so "g=64,256 p=1000 seeds=50" runs 100 jobs. Every other
+   parameter, including the stop criteria, is shared by all the runs, but
+   checkpoints and statistics are not supported.
+   The jobs are scheduled over a pool of c->threads workers, each running
+   one job at a time on a single thread. Every worker owns a range of job
+   numbers packed in one atomic word (first job in the low half, end in the
+   high half): it takes jobs from the front of its own range, and when it is
+   empty it steals the back half of the range of another worker, so that
+   slow points of the grid get spread over the pool. A worker allocates one
+   population, as large as the largest point of the grid needs, and reuses
+   it for every job. Every job draws from its own stream, seeded with its
+   seed, so the results do not depend on the schedule. They are written at
+   the end to a single CSV file with one line per point of the grid: the
+   number of runs, how many reached the target, the mean and standard
+   deviation of the generations, the mean best fitness and the mean time
+   in seconds of a run
 */
+#define SWEEP_MAX_VALUES 64
 
-void crossover(int * parent1, int * parent2, int * offspring1,
-               int * offspring2, int c_point){
-   int j;
-   for (j=0;j<c_point;j++){
-      offspring1[j] = parent1[j];
-      offspring2[j] = parent2[j];
+typedef struct {
+   int n;
+   int v[SWEEP_MAX_VALUES];
+} sweep_list;
+
+typedef struct {
+   int generations;
+   int why;
+   float best;
+   double seconds;
+} job_result;
+
+typedef struct {
+   _Atomic uint64_t range;
+   char pad[ALIGN_BYTES - sizeof(uint64_t)];
+} worker_range;
+
+static inline uint64_t pack_range(uint32_t lo, uint32_t hi){
+   return ((uint64_t) hi << 32) | lo;
+}
+
+int parse_sweep(const char * spec, sweep_list * g, sweep_list * p,
+                sweep_list * b, int * seeds){
+   char * copy = strdup(spec);
+   char * save = NULL;
+   char * tok;
+   int err = copy == NULL;
+   for (tok=strtok_r(copy, " ;", &save);tok!=NULL && !err;
+        tok=strtok_r(NULL, " ;", &save)){
+      char * eq = strchr(tok, '=');
+      sweep_list seed_list;
+      sweep_list * l = NULL;
+      char * save2 = NULL;
+      char * v;
+      if (eq == NULL){
+         err = 1;
+         break;
+      }
+      *eq = '\0';
+      if (strcmp(tok, "g") == 0){
+         l = g;
+      }else if (strcmp(tok, "p") == 0){
+         l = p;
+      }else if (strcmp(tok, "b") == 0){
+         l = b;
+      }else if (strcmp(tok, "seeds") == 0){
+         l = &seed_list;
+      }else{
+         err = 1;
+         break;
+      }
+      l->n = 0;
+      for (v=strtok_r(eq+1, ",", &save2);v!=NULL && !err;
+           v=strtok_r(NULL, ",", &save2)){
+         err = l->n == SWEEP_MAX_VALUES ||
+               parse_int(v, "--sweep", &l->v[l->n]) || l->v[l->n] < 1;
+         l->n++;
+      }
+      err |= l->n == 0 || (l == &seed_list && l->n > 1);
+      if (l == &seed_list && !err){
+         *seeds = seed_list.v[0];
+      }
    }
-   for (j=c_point;j<G_SIZE;j++){
-      offspring1[j] = parent2[j];
-      offspring2[j] = parent1[j];
+   if (err){
+      fprintf(stderr, "Invalid value for --sweep: %s\n", spec);
    }
+   free(copy);
+   return err;
 }
 
+/*
+   Function to run one job of the sweep, the GA loop of main without any
+   output, on a population already carved for its configuration
+*/
+
+void run_job(const config * c, population * p, job_result * out){
+   rng_t r;
+   stop_state s;
+   int g = 1;
+   rng_seed(&r, c->seed);
+   start_stop(&s);
+   rand_population(c, p, &r);
+   evaluate_population(c, p);
+   if (c->alleles){
+      count_alleles(c, p);
+   }
+   order_population(c, p);
+   while ((out->why = check_stop(c, &s, p->score[p->best],
+                                 population_diversity(c, p, NULL), g)) ==
+          STOP_NONE){
+      breed_population(c, p, &r);
+      g++;
+   }
+   out->generations = g;
+   out->best = fitness(c, p, p->best);
+   out->seconds = wall_time() - s.start;
+}
 
 /*
-   Functions to sort the words in the population according to their respective
-   fitness. The function "comp" is used internally in sort_P_by_fitness, which
-   is an implementation of the Quicksort algorithm
-*/   
+   Function to take the next job of worker "id", from its own range or
+   stolen from another one. Returns -1 when there are no jobs left
+*/
 
-int comp(const void *a, const void *b){
-   float diff = fitness((int *)a) - fitness((int *)b);
-   printf ("%.4f vs %.4f\n",fitness((int *)a),fitness((int *)b));
-   if (diff == 0){
-      return 0;
-   }else if (diff < 0){
+int next_job(worker_range * w, int n, int id){
+   int k;
+   for (k=0;k<n;k++){
+      worker_range * v = &w[(id + k) % n];
+      uint64_t old = atomic_load(&v->range);
+      for (;;){
+         uint32_t lo = (uint32_t) old;
+         uint32_t hi = (uint32_t) (old >> 32);
+         if (lo >= hi){
+            break;
+         }
+         if (k == 0){
+            if (atomic_compare_exchange_weak(&v->range, &old,
+                                             pack_range(lo + 1, hi))){
+               return (int) lo;
+            }
+         }else{
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (atomic_compare_exchange_weak(&v->range, &old,
+                                             pack_range(lo, mid))){
+               atomic_store(&w[id].range, pack_range(mid + 1, hi));
+               return (int) mid;
+            }
+         }
+      }
+   }
+   return -1;
+}
+
+int run_sweep(const config * c){
+   sweep_list g = {1, {c->g_size}};
+   sweep_list p = {1, {c->p_size}};
+   sweep_list b = {1, {c->bottleneck}};
+   int seeds = 1;
+   int i,s;
+   if (parse_sweep(c->sweep, &g, &p, &b, &seeds)){
+      return 1;
+   }
+   int points = g.n * p.n * b.n;
+   int jobs = points * seeds;
+   config * cfg = malloc((size_t) points * sizeof(config));
+   objective * obj = malloc((size_t) points * sizeof(objective));
+   job_result * res = malloc((size_t) jobs * sizeof(job_result));
+   int nw = c->threads < jobs ? c->threads : jobs;
+   worker_range * w = aligned_alloc(ALIGN_BYTES,
+                                    (size_t) nw * sizeof(worker_range));
+   size_t bytes = 0;
+   int status = 0;
+   if (cfg == NULL || obj == NULL || res == NULL || w == NULL){
+      fprintf(stderr, "Not enough memory for the sweep\n");
+      free(cfg);
+      free(obj);
+      free(res);
+      free(w);
       return 1;
-   }else{
-      return -1;
    }
+
+   /* One configuration per point, with its own copy of the objective */
+   for (i=0;i<points;i++){
+      config * pc = &cfg[i];
+      *pc = *c;
+      pc->g_size = g.v[i / (p.n * b.n)];
+      pc->p_size = p.v[i / b.n % p.n];
+      pc->bottleneck = pc->offspring = b.v[i % b.n];
+      pc->threads = 1;
+      pc->islands = 1;
+      pc->profile = 0;
+      obj[i] = *c->obj;
+      obj[i].max_score = (float) pc->g_size;
+      obj[i].levels = pc->g_size;
+      pc->obj = &obj[i];
+      derive_sizes(pc);
+      if (pc->bottleneck % 2 || pc->bottleneck < 2 ||
+          pc->bottleneck > pc->p_size){
+         fprintf(stderr, "Invalid sweep point G = %i, P = %i, B = %i: the "
+                         "bottleneck must be even, at least 2 and at most "
+                         "P\n", pc->g_size, pc->p_size, pc->bottleneck);
+         status = 1;
+      }
+      if (population_bytes(pc) > bytes){
+         bytes = population_bytes(pc);
+      }
+   }
+   for (i=0;i<nw;i++){
+      atomic_init(&w[i].range,
+                  pack_range((uint32_t) ((long long) jobs * i / nw),
+                             (uint32_t) ((long long) jobs * (i + 1) / nw)));
+   }
+
+   if (!status){
+      #pragma omp parallel num_threads(nw) reduction(|:status)
+      {
+         int id = thread_id();
+         population * wp = calloc(1, sizeof(population));
+         int job;
+         if (wp == NULL || arena_init(&wp->mem, bytes)){
+            free(wp);
+            wp = NULL;
+            status = 1;
+         }
+         while (wp != NULL && (job = next_job(w, nw, id)) >= 0){
+            config jc = cfg[job / seeds];
+            jc.seed = c->seed + (uint64_t) (job % seeds);
+            reuse_population(&jc, wp);
+            run_job(&jc, wp, &res[job]);
+         }
+         free_population(wp);
+      }
+      if (status){
+         fprintf(stderr, "Not enough memory for the sweep\n");
+      }
+   }
+
+   if (!status){
+      FILE * f = strcmp(c->sweep_out, "-") == 0 ? stdout :
+                 fopen(c->sweep_out, "w");
+      if (f == NULL){
+         fprintf(stderr, "Cannot write the sweep results to %s\n",
+                 c->sweep_out);
+         status = 1;
+      }else{
+         fprintf(f, "g,p,b,runs,solved,mean_generations,sd_generations,"
+                    "mean_best,mean_seconds\n");
+         for (i=0;i<points;i++){
+            double sg = 0, sg2 = 0, sb = 0, st = 0;
+            int solved = 0;
+            for (s=0;s<seeds;s++){
+               const job_result * jr = &res[i * seeds + s];
+               sg += jr->generations;
+               sg2 += (double) jr->generations * jr->generations;
+               sb += jr->best;
+               st += jr->seconds;
+               solved += jr->why == STOP_TARGET;
+            }
+            double mean = sg / seeds;
+            double var = seeds > 1 ? (sg2 - sg * mean) / (seeds - 1) : 0;
+            fprintf(f, "%i,%i,%i,%i,%i,%.6g,%.6g,%.6g,%.6g\n",
+                    cfg[i].g_size, cfg[i].p_size, cfg[i].bottleneck, seeds,
+                    solved, mean, var > 0 ? sqrt(var) : 0, sb / seeds,
+                    st / seeds);
+         }
+         if (f == stdout){
+            status = fflush(f) != 0;
+         }else{
+            status = fclose(f) != 0;
+         }
+      }
+   }
+   free(cfg);
+   free(obj);
+   free(res);
+   free(w);
+   return status;
+}
+
+
+/*
+   Functions to read the configuration from the command line. read_config
+   fills in the defaults, parses the flags described in usage() and checks
+   the values, returning 0 on success and 1 if the program must stop.
+   derive_config fills in the fields derived from the others
+*/
+
+void usage(const char * name){
+   fprintf(stderr,
+      "Usage: %s [options]\n"
+      "  -g, --genome-size N   bits in each word (n, default 16)\n"
+      "  -p, --population N    words in the population (m, default 40)\n"
+      "  -b, --bottleneck N    parents of each generation (b, default 20)\n"
+      "  -o, --offspring N     words bred per generation, replacing the\n"
+      "                        least fit ones (even, default b)\n"
+      "  -m, --generations N   maximum number of generations (bmax, default\n"
+      "                        10)\n"
+      "      --quicksort       rank with Quicksort instead of counting sort\n"
+      "      --partition       only split the population at the bottleneck\n"
+      "  -s, --seed N          seed of the random number generator (default\n"
+      "                        taken from the clock)\n"
+      "  -t, --threads N       threads to run on (default 1, needs OpenMP)\n"
+      "  -i, --islands N       independent populations of m words, one\n"
+      "                        thread each (default 1)\n"
+      "      --migration-interval N\n"
+      "                        generations between migrations (default 10)\n"
+      "      --migrants N      words sent to the next island at each\n"
+      "                        migration (at most b and m/2, default 2)\n"
+      "  -x, --crossover TYPE  one, two (points) or uniform (default one)\n"
+      "      --selection TYPE  truncation, tournament or roulette (default\n"
+      "                        truncation)\n"
+      "      --tournament K    words in each tournament (default 2)\n"
+      "      --steady-state    breed two words at a time, replacing the\n"
+      "                        two least fit, -o words per generation\n"
+      "      --async           steady state evaluating the offspring on\n"
+      "                        --threads - 1 threads while breeding\n"
+      "      --mutation-rate P probability of flipping each gene of the\n"
+      "                        offspring (default 0)\n"
+      "      --target F        stop when a word reaches this fitness\n"
+      "                        (default 1)\n"
+      "      --stagnation N    stop after N generations without improving\n"
+      "                        the best fitness (default 0, never)\n"
+      "      --time-limit S    stop after S seconds (default 0, never)\n"
+      "      --min-diversity D stop when the diversity of the population\n"
+      "                        falls below D (default 0, never)\n"
+      "      --checkpoint FILE save the state of the run to FILE\n"
+      "      --checkpoint-every N\n"
+      "                        generations between checkpoints (default\n"
+      "                        100)\n"
+      "      --resume FILE     resume the run saved in FILE, with the same\n"
+      "                        genome size, population, threads and GA\n"
+      "                        parameters\n"
+      "  -f, --fitness NAME    fitness function: onemax (default) or\n"
+      "                        leadingones\n"
+      "      --full-eval       always evaluate the offspring from scratch,\n"
+      "                        even if the fitness function can be updated\n"
+      "                        incrementally\n"
+      "      --stats FILE      write the statistics of every generation to\n"
+      "                        FILE as CSV (- for the standard output)\n"
+      "      --dump FILE       write the final population to FILE in\n"
+      "                        hexadecimal\n"
+      "  -q, --quiet           do not print the populations nor the best\n"
+      "                        fitness of every generation\n"
+      "      --profile         print the time spent in every phase\n"
+      "      --benchmark       time a grid of genome sizes, populations and\n"
+      "                        bottlenecks of -m generations each\n"
+      "      --kernels NAME    auto (default, the best one supported),\n"
+      "                        avx512, avx2, popcnt or generic\n"
+      "      --sweep GRID      run a grid of independent runs on --threads\n"
+      "                        workers, e.g. \"g=64,256 p=1000 b=20,100\n"
+      "                        seeds=50\"\n"
+      "      --sweep-out FILE  file for the results of the sweep (default\n"
+      "                        -, the standard output)\n"
+      "      --memo-size N     remember the scores of the last N or so\n"
+      "                        genomes evaluated in full (default 0)\n"
+      "  -v, --verbose         print every comparison made while ranking\n"
+      "                        (only with --quicksort and truncation)\n"
+      "  -h, --help            show this help\n",
+      name);
+}
+
+int parse_int(const char * arg, const char * flag, int * out){
+   char * end;
+   long v = strtol(arg, &end, 10);
+   if (*arg == '\0' || *end != '\0' || v < 0 || v > INT32_MAX){
+      fprintf(stderr, "Invalid value for %s: %s\n", flag, arg);
+      return 1;
+   }
+   *out = (int) v;
+   return 0;
+}
+
+int parse_rate(const char * arg, const char * flag, double * out){
+   char * end;
+   double v = strtod(arg, &end);
+   if (*arg == '\0' || *end != '\0' || !(v >= 0 && v <= 1)){
+      fprintf(stderr, "Invalid value for %s: %s\n", flag, arg);
+      return 1;
+   }
+   *out = v;
+   return 0;
 }
 
-void sort_P_by_fitness(int p[P_SIZE][G_SIZE]){
-   qsort(p, P_SIZE, sizeof(int [G_SIZE]), comp);
+int parse_seconds(const char * arg, const char * flag, double * out){
+   char * end;
+   double v = strtod(arg, &end);
+   if (*arg == '\0' || *end != '\0' || !(v >= 0 && v < 1e9)){
+      fprintf(stderr, "Invalid value for %s: %s\n", flag, arg);
+      return 1;
+   }
+   *out = v;
+   return 0;
 }
 
+int parse_seed(const char * arg, uint64_t * out){
+   char * end;
+   unsigned long long v = strtoull(arg, &end, 0);
+   if (*arg == '\0' || *arg == '-' || *end != '\0'){
+      fprintf(stderr, "Invalid value for --seed: %s\n", arg);
+      return 1;
+   }
+   *out = (uint64_t) v;
+   return 0;
+}
 
 /*
-   Randomly shuffle an array. This function is an implementation of the
-   modern version of the Fisher-Yates shuffle
+   Functions to set up a config: default_config sets the defaults of every
+   parameter, and check_config checks a config once its parameters are set,
+   filling in the default offspring, and returns 0 if the run is possible
+   and 1 (printing why) otherwise. read_config reads the parameters from the
+   command line between the two
 */
 
-void shuffle_array(int * a, int n){
-   int i;
-   for (i=n-1;i>0;i--){
-      int j = rand() % (i+1);
-      int temp = a[j];
-      a[j] = a[i];
-      a[i] = temp;      
-    }
+void default_config(config * c){
+   c->g_size = 16;
+   c->p_size = 40;
+   c->bottleneck = 20;
+   c->offspring = -1;
+   c->max_generations = 10;
+   c->verbose = 0;
+   c->counting_sort = 1;
+   c->partition = 0;
+   c->seed = (uint64_t) time(NULL);
+   c->threads = 1;
+   c->islands = 1;
+   c->migration_interval = 10;
+   c->migrants = 2;
+   c->crossover_type = CROSSOVER_ONE_POINT;
+   c->obj = &objectives[0];
+   c->incremental = 1;
+   c->selection = SELECTION_TRUNCATION;
+   c->tournament_size = 2;
+   c->steady_state = 0;
+   c->async = 0;
+   c->mutation_rate = 0;
+   c->target = 1;
+   c->stagnation = 0;
+   c->time_limit = 0;
+   c->min_diversity = 0;
+   c->checkpoint = NULL;
+   c->checkpoint_every = 100;
+   c->resume = NULL;
+   c->stats = NULL;
+   c->dump = NULL;
+   c->quiet = 0;
+   c->profile = 0;
+   c->benchmark = 0;
+   c->kernels = NULL;
+   c->sweep = NULL;
+   c->sweep_out = "-";
+   c->memo_size = 0;
+   c->memo = NULL;
+}
+
+int check_config(config * c){
+   if (c->g_size < 1 || c->p_size < 2 || c->bottleneck < 2 ||
+       c->threads < 1 || c->islands < 1 || c->migration_interval < 1 ||
+       c->tournament_size < 1 || c->checkpoint_every < 1){
+      fprintf(stderr, "The genome size, threads, islands, migration "
+                      "interval, tournament size and checkpoint interval "
+                      "must be at least 1, and the population and "
+                      "bottleneck at least 2\n");
+      return 1;
+   }
+   if (c->islands > 1 && (c->checkpoint != NULL || c->resume != NULL ||
+                          c->stats != NULL || c->benchmark ||
+                          c->sweep != NULL)){
+      fprintf(stderr, "Checkpoints, statistics, the benchmark and sweeps "
+                      "are not supported with islands\n");
+      return 1;
+   }
+   if (c->sweep != NULL && (c->checkpoint != NULL || c->resume != NULL ||
+                            c->stats != NULL)){
+      fprintf(stderr, "Checkpoints and statistics are not supported in "
+                      "sweeps\n");
+      return 1;
+   }
+   if (c->verbose && (c->counting_sort || c->partition ||
+                      c->selection != SELECTION_TRUNCATION)){
+      fprintf(stderr, "-v only prints the comparisons of --quicksort, "
+                      "with truncation selection and without "
+                      "--partition\n");
+   }
+#ifndef _OPENMP
+   if (c->threads > 1){
+      fprintf(stderr, "Compiled without OpenMP, running on a single "
+                      "thread\n");
+      c->threads = 1;
+   }
+#endif
+   if (c->offspring < 0){
+      c->offspring = c->bottleneck;
+   }
+   if (c->offspring < 2 || c->offspring % 2){
+      fprintf(stderr, "The offspring must be an even number, at least 2\n");
+      return 1;
+   }
+   if (c->bottleneck > c->p_size || c->offspring > c->p_size){
+      fprintf(stderr, "The bottleneck and offspring cannot be larger than "
+                      "the population\n");
+      return 1;
+   }
+   if (c->steady_state && c->selection == SELECTION_ROULETTE){
+      fprintf(stderr, "The roulette selection is not supported in steady "
+                      "state\n");
+      return 1;
+   }
+   if ((c->islands > 1 || mpi_ranks > 1) &&
+       (c->migrants > c->bottleneck || c->migrants > c->p_size / 2)){
+      fprintf(stderr, "There cannot be more migrants than the bottleneck or "
+                      "half the population\n");
+      return 1;
+   }
+
+   return 0;
+}
+
+int read_config(int argc, char ** argv, config * c){
+   static const struct option options[] = {
+      {"genome-size", required_argument, NULL, 'g'},
+      {"population",  required_argument, NULL, 'p'},
+      {"bottleneck",  required_argument, NULL, 'b'},
+      {"offspring",   required_argument, NULL, 'o'},
+      {"generations", required_argument, NULL, 'm'},
+      {"quicksort",   no_argument,       NULL, 'Q'},
+      {"partition",   no_argument,       NULL, 'P'},
+      {"seed",        required_argument, NULL, 's'},
+      {"threads",     required_argument, NULL, 't'},
+      {"islands",     required_argument, NULL, 'i'},
+      {"migration-interval", required_argument, NULL, 'I'},
+      {"migrants",    required_argument, NULL, 'M'},
+      {"crossover",   required_argument, NULL, 'x'},
+      {"fitness",     required_argument, NULL, 'f'},
+      {"full-eval",   no_argument,       NULL, 'F'},
+      {"mutation-rate", required_argument, NULL, 'u'},
+      {"selection",   required_argument, NULL, 'S'},
+      {"tournament",  required_argument, NULL, 'T'},
+      {"steady-state", no_argument,      NULL, 'J'},
+      {"async",       no_argument,       NULL, 'X'},
+      {"target",      required_argument, NULL, 'G'},
+      {"stagnation",  required_argument, NULL, 'N'},
+      {"time-limit",  required_argument, NULL, 'L'},
+      {"min-diversity", required_argument, NULL, 'A'},
+      {"checkpoint",  required_argument, NULL, 'C'},
+      {"checkpoint-every", required_argument, NULL, 'E'},
+      {"resume",      required_argument, NULL, 'R'},
+      {"stats",       required_argument, NULL, 'D'},
+      {"dump",        required_argument, NULL, 'W'},
+      {"quiet",       no_argument,       NULL, 'q'},
+      {"profile",     no_argument,       NULL, 'Z'},
+      {"benchmark",   no_argument,       NULL, 'B'},
+      {"kernels",     required_argument, NULL, 'K'},
+      {"sweep",       required_argument, NULL, 'Y'},
+      {"sweep-out",   required_argument, NULL, 'O'},
+      {"memo-size",   required_argument, NULL, 'H'},
+      {"verbose",     no_argument,       NULL, 'v'},
+      {"help",        no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+   int opt;
+   int err = 0;
+
+   default_config(c);
+
+   while ((opt = getopt_long(argc, argv, "g:p:b:o:m:s:t:i:x:f:qvh", options,
+                             NULL)) != -1){
+      switch (opt){
+         case 'g': err |= parse_int(optarg, "--genome-size", &c->g_size);
+                   break;
+         case 'p': err |= parse_int(optarg, "--population", &c->p_size);
+                   break;
+         case 'b': err |= parse_int(optarg, "--bottleneck", &c->bottleneck);
+                   break;
+         case 'o': err |= parse_int(optarg, "--offspring", &c->offspring);
+                   break;
+         case 'm': err |= parse_int(optarg, "--generations",
+                                    &c->max_generations);
+                   break;
+         case 'Q': c->counting_sort = 0; break;
+         case 'P': c->partition = 1; break;
+         case 'F': c->incremental = 0; break;
+         case 'u': err |= parse_rate(optarg, "--mutation-rate",
+                                     &c->mutation_rate);
+                   break;
+         case 's': err |= parse_seed(optarg, &c->seed); break;
+         case 't': err |= parse_int(optarg, "--threads", &c->threads); break;
+         case 'i': err |= parse_int(optarg, "--islands", &c->islands); break;
+         case 'I': err |= parse_int(optarg, "--migration-interval",
+                                    &c->migration_interval);
+                   break;
+         case 'M': err |= parse_int(optarg, "--migrants", &c->migrants);
+                   break;
+         case 'x':
+            if (strcmp(optarg, "one") == 0){
+               c->crossover_type = CROSSOVER_ONE_POINT;
+            }else if (strcmp(optarg, "two") == 0){
+               c->crossover_type = CROSSOVER_TWO_POINT;
+            }else if (strcmp(optarg, "uniform") == 0){
+               c->crossover_type = CROSSOVER_UNIFORM;
+            }else{
+               fprintf(stderr, "Invalid value for --crossover: %s\n", optarg);
+               err = 1;
+            }
+            break;
+         case 'S':
+            if (strcmp(optarg, "truncation") == 0){
+               c->selection = SELECTION_TRUNCATION;
+            }else if (strcmp(optarg, "tournament") == 0){
+               c->selection = SELECTION_TOURNAMENT;
+            }else if (strcmp(optarg, "roulette") == 0){
+               c->selection = SELECTION_ROULETTE;
+            }else{
+               fprintf(stderr, "Invalid value for --selection: %s\n", optarg);
+               err = 1;
+            }
+            break;
+         case 'T': err |= parse_int(optarg, "--tournament",
+                                    &c->tournament_size);
+                   break;
+         case 'J': c->steady_state = 1; break;
+         case 'X': c->async = c->steady_state = 1; break;
+         case 'G': err |= parse_rate(optarg, "--target", &c->target); break;
+         case 'N': err |= parse_int(optarg, "--stagnation", &c->stagnation);
+                   break;
+         case 'L': err |= parse_seconds(optarg, "--time-limit",
+                                        &c->time_limit);
+                   break;
+         case 'A': err |= parse_rate(optarg, "--min-diversity",
+                                     &c->min_diversity);
+                   break;
+         case 'C': c->checkpoint = optarg; break;
+         case 'E': err |= parse_int(optarg, "--checkpoint-every",
+                                    &c->checkpoint_every);
+                   break;
+         case 'R': c->resume = optarg; break;
+         case 'D': c->stats = optarg; break;
+         case 'W': c->dump = optarg; break;
+         case 'q': c->quiet = 1; break;
+         case 'Z': c->profile = 1; break;
+         case 'B': c->benchmark = 1; break;
+         case 'K': c->kernels = optarg; break;
+         case 'Y': c->sweep = optarg; break;
+         case 'O': c->sweep_out = optarg; break;
+         case 'H': err |= parse_int(optarg, "--memo-size", &c->memo_size);
+                   break;
+         case 'f': {
+            int k;
+            for (k=0;k<N_OBJECTIVES && strcmp(optarg, objectives[k].name);k++){
+            }
+            if (k < N_OBJECTIVES){
+               c->obj = &objectives[k];
+            }else{
+               fprintf(stderr, "Invalid value for --fitness: %s\n", optarg);
+               err = 1;
+            }
+            break;
+         }
+         case 'v': c->verbose = 1; break;
+         default: usage(argv[0]); return 1;
+      }
+   }
+   if (err){
+      return 1;
+   }
+   if (optind < argc){
+      fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+      usage(argv[0]);
+      return 1;
+   }
+   if (check_config(c)){
+      return 1;
+   }
+   derive_config(c);
+   return 0;
+}
+
+void derive_config(config * c){
+   int k;
+   for (k=0;k<N_OBJECTIVES;k++){
+      objectives[k].max_score = (float) c->g_size;
+      objectives[k].levels = c->g_size;
+   }
+   derive_sizes(c);
+}
+
+void derive_sizes(config * c){
+   c->target_score = (float) (c->target * c->obj->max_score);
+   if (c->obj->levels > 0){
+      c->target_score = ceilf(c->target_score);
+   }
+   c->mutation_log = log1p(-c->mutation_rate);
+   c->alleles = c->stats != NULL || c->min_diversity > 0;
+   c->g_words = (c->g_size + WORD_BITS - 1) / WORD_BITS;
+   c->stride = (int) round_up((size_t) c->g_words, ALIGN_WORDS);
 }
 
 
 /*
-   Function to bring the population through a generation cycle. The top fittest
-   words (defined by BOTTLENECK) in the population are randomly crossovered in
-   pairs in order to give raise to the progeny. The offspring will substitute
-   the bottom words in the population.
+   The library (see ga.h). A run is a population with its own config, its
+   own copy of the objective (the scores of the built-in ones are bounded by
+   the genome size of the run), its streams of random numbers and its memo.
+   A fitness callback is wrapped as an objective without levels, so its
+   scores can be any floats, ranked with Quicksort, and without incremental
+   evaluation. The generation counts the generations run so far, and
+   "order" is the full ranking of the population handed out by
+   ga_population(): the ranking of the population itself is only partial
+   with tournament and roulette selection, so it is then sorted apart, into
+   "keys", without changing the run
 */
+struct ga {
+   config c;
+   objective obj;
+   memo_table memo;
+   population * p;
+   rng_t * r;
+   fkey * keys;
+   int * order;
+   int generation;
+   ga_fitness callback;
+   ga_report report;
+   void * user;
+};
+
+static void eval_callback(const objective * o, const config * c,
+                          const word_t * genomes, int n, float * out){
+   const ga * g = o->data;
+   g->callback(g->user, genomes, n, c->stride, out);
+}
 
-void next_generation (int p[P_SIZE][G_SIZE]){
-   int fittest[BOTTLENECK];
+static void report_generation(const ga * g){
+   if (g->report != NULL){
+      ga_stats st;
+      population_stats(&g->c, g->p, g->generation, &st);
+      g->report(g->user, &st);
+   }
+}
+
+static void rank_view(ga * g){
+   const config * c = &g->c;
+   const population * p = g->p;
    int i;
-   for (i=0;i<BOTTLENECK;i++){
-      fittest[i] = i;
+   if (c->selection == SELECTION_TRUNCATION && !c->partition){
+      memcpy(g->order, p->order, (size_t) c->p_size * sizeof(int));
+      return;
+   }
+   for (i=0;i<c->p_size;i++){
+      g->keys[i].score = p->score[i];
+      g->keys[i].row = i;
+   }
+   qsort(g->keys, c->p_size, sizeof(fkey), comp);
+   for (i=0;i<c->p_size;i++){
+      g->order[i] = g->keys[i].row;
+   }
+}
+
+int ga_init(const char * kernels){
+   return select_kernels(kernels);
+}
+
+void ga_defaults(ga_params * p){
+   config c;
+   default_config(&c);
+   p->genome_size = c.g_size;
+   p->population = c.p_size;
+   p->bottleneck = c.bottleneck;
+   p->offspring = c.offspring;
+   p->crossover = c.crossover_type;
+   p->selection = c.selection;
+   p->tournament = c.tournament_size;
+   p->steady_state = c.steady_state;
+   p->async = c.async;
+   p->threads = c.threads;
+   p->memo_size = c.memo_size;
+   p->mutation_rate = c.mutation_rate;
+   p->target = c.target;
+   p->seed = c.seed;
+   p->fitness = c.obj->name;
+   p->callback = NULL;
+   p->max_score = HUGE_VALF;
+   p->report = NULL;
+   p->user = NULL;
+}
+
+ga * ga_create(const ga_params * p){
+   ga * g = calloc(1, sizeof(ga));
+   int k;
+   if (g == NULL){
+      fprintf(stderr, "Not enough memory for the population\n");
+      return NULL;
    }
+   config * c = &g->c;
+   default_config(c);
+   c->g_size = p->genome_size;
+   c->p_size = p->population;
+   c->bottleneck = p->bottleneck;
+   c->offspring = p->offspring;
+   c->crossover_type = p->crossover;
+   c->selection = p->selection;
+   c->tournament_size = p->tournament;
+   c->async = p->async;
+   c->steady_state = p->steady_state || p->async;
+   c->threads = p->threads;
+   c->memo_size = p->memo_size;
+   c->mutation_rate = p->mutation_rate;
+   c->target = p->target;
+   c->seed = p->seed;
+   c->quiet = 1;
+   g->callback = p->callback;
+   g->report = p->report;
+   g->user = p->user;
+   if (p->callback != NULL){
+      objective o = {"callback", eval_callback, p->max_score, 0, 0, g};
+      g->obj = o;
+   }else{
+      for (k=0;k<N_OBJECTIVES && (p->fitness == NULL ||
+                                  strcmp(p->fitness, objectives[k].name));
+           k++){
+      }
+      if (k == N_OBJECTIVES){
+         fprintf(stderr, "Invalid fitness function: %s\n",
+                 p->fitness == NULL ? "(null)" : p->fitness);
+         free(g);
+         return NULL;
+      }
+      g->obj = objectives[k];
+      g->obj.max_score = (float) c->g_size;
+      g->obj.levels = c->g_size;
+   }
+   c->obj = &g->obj;
+   if ((unsigned) c->crossover_type > CROSSOVER_UNIFORM ||
+       (unsigned) c->selection > SELECTION_ROULETTE ||
+       !(c->mutation_rate >= 0 && c->mutation_rate <= 1) ||
+       !(c->target >= 0 && c->target <= 1)){
+      fprintf(stderr, "Invalid crossover, selection, mutation rate or "
+                      "target\n");
+      free(g);
+      return NULL;
+   }
+   if (check_config(c)){
+      free(g);
+      return NULL;
+   }
+   derive_sizes(c);
+   c->alleles = p->report != NULL;
+
+   g->r = malloc((size_t) c->threads * sizeof(rng_t));
+   g->keys = malloc((size_t) c->p_size * sizeof(fkey));
+   g->order = malloc((size_t) c->p_size * sizeof(int));
+   g->p = new_population(c);
+   if (g->r == NULL || g->keys == NULL || g->order == NULL || g->p == NULL){
+      fprintf(stderr, "Not enough memory for the population\n");
+      ga_destroy(g);
+      return NULL;
+   }
+   if (c->memo_size > 0 && open_memo(c, &g->memo)){
+      ga_destroy(g);
+      return NULL;
+   }
+   rng_streams(g->r, c->threads, c->seed);
+   rand_population(c, g->p, g->r);
+   evaluate_population(c, g->p);
+   if (c->alleles){
+      count_alleles(c, g->p);
+   }
+   order_population(c, g->p);
+   if (c->steady_state){
+      rank_population(c, g->p);
+   }
+   rank_view(g);
+   report_generation(g);
+   return g;
+}
+
+int ga_step(ga * g, int n){
+   const config * c = &g->c;
+   int s;
+   for (s=0;s<n && g->p->score[g->p->best] < c->target_score;s++){
+      breed_population(c, g->p, g->r);
+      g->generation++;
+      report_generation(g);
+   }
+   if (c->steady_state){
+      rank_population(c, g->p);
+   }
+   rank_view(g);
+   return s;
+}
 
-   shuffle_array(fittest, BOTTLENECK);
+float ga_best(const ga * g, const uint64_t ** genome){
+   if (genome != NULL){
+      *genome = row_genome(&g->c, g->p, g->p->best);
+   }
+   return g->p->score[g->p->best];
+}
+
+void ga_population(const ga * g, ga_view * v){
+   v->genomes = g->p->genome;
+   v->scores = g->p->score;
+   v->order = g->order;
+   v->rows = g->c.p_size;
+   v->words = g->c.g_words;
+   v->stride = g->c.stride;
+}
 
-   for(i=0;i<BOTTLENECK/2;i++){
-      crossover(p[fittest[i*2]], p[fittest[(i*2)+1]], p[P_SIZE-i*2-2],
-                p[P_SIZE-(i*2)-1], rand()%G_SIZE);
+void ga_destroy(ga * g){
+   if (g == NULL){
+      return;
    }
+   free_population(g->p);
+   close_memo(&g->c);
+   free(g->r);
+   free(g->keys);
+   free(g->order);
+   free(g);
 }
 
 
 /*
-   MAIN
-   GA simulation
+   GA simulation: the whole program but for MPI, which main() starts and
+   stops around it
 */
 
-int main(){
-   if (P_SIZE % 2 || BOTTLENECK % 2){
-      printf("Re-compile with even numbers for P_SIZE and BOTTLENECK in the",
-              "#declares\n");
+int run_main(int argc, char ** argv){
+   config C;
+   if (read_config(argc, argv, &C)){
+      return 1;
+   }
+   verbose = C.verbose;
+   if (select_kernels(C.kernels)){
+      return 1;
+   }
+#ifdef GA_MPI
+   if (mpi_ranks > 1 && (C.checkpoint != NULL || C.resume != NULL ||
+                         C.stats != NULL || C.benchmark || C.sweep != NULL)){
+      fprintf(stderr, "Checkpoints, statistics, the benchmark and sweeps "
+                      "are not supported over MPI\n");
       return 1;
    }
+   MPI_Bcast(&C.seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+#endif
 
    /* Initialization */
-   int P[P_SIZE][G_SIZE];
+   int streams = mpi_ranks * C.islands * C.threads;
+   rng_t * R = malloc((size_t) streams * sizeof(rng_t));
+   if (R == NULL){
+      fprintf(stderr, "Not enough memory for the population\n");
+      return 1;
+   }
+   rng_streams(R, streams, C.seed);
+
+   memo_table M;
+   if (C.memo_size > 0 && open_memo(&C, &M)){
+      free(R);
+      return 1;
+   }
+   if (C.benchmark){
+      int status = run_benchmark(&C, R);
+      print_memo(&C);
+      close_memo(&C);
+      free(R);
+      return status;
+   }
+   if (C.sweep != NULL){
+      free(R);
+      int status = run_sweep(&C);
+      close_memo(&C);
+      return status;
+   }
+   if (C.islands > 1 || mpi_ranks > 1){
+      if (mpi_rank == 0){
+         printf("Seed: %llu\n", (unsigned long long) C.seed);
+      }
+      int status = run_islands(&C, R);
+      print_memo(&C);
+      close_memo(&C);
+      free(R);
+      return status;
+   }
 
-   rand_population(P);
-   print_population(P);
-   printf("--------------------------------\n");
-   sort_P_by_fitness(P);
+   population * P = new_population(&C);
+   if (P == NULL){
+      fprintf(stderr, "Not enough memory for the population\n");
+      close_memo(&C);
+      free(R);
+      return 1;
+   }
+   stop_state S;
+   stats_sink T;
+   int g=1;
+   int why;
+   int status = 0;
+   start_stop(&S);
+   if (C.resume != NULL){
+      if (load_checkpoint(&C, P, R, C.threads, &g, &S, C.resume)){
+         free_population(P);
+         close_memo(&C);
+         free(R);
+         return 1;
+      }
+      printf("Seed: %llu\n", (unsigned long long) C.seed);
+      printf("Resumed from %s at generation %i\n", C.resume, g);
+   }else{
+      printf("Seed: %llu\n", (unsigned long long) C.seed);
+      rand_population(&C, P, R);
+      evaluate_population(&C, P);
+      if (!C.quiet){
+         print_population(&C, P);
+         printf("--------------------------------\n");
+      }
+   }
+   if (C.alleles){
+      count_alleles(&C, P);
+   }
+   order_population(&C, P);
+   if (C.stats != NULL){
+      if (open_stats(&C, &T, C.resume != NULL)){
+         fprintf(stderr, "Cannot write the statistics to %s\n", C.stats);
+         free_population(P);
+         close_memo(&C);
+         free(R);
+         return 1;
+      }
+      if (C.resume == NULL){
+         write_stats(&C, &T, P, g-1);
+      }
+   }
 
    /* Run GA (Selection + Reproduction + Termination) */
 
-   int g=1;
-   while (fitness(P[0]) != 1 && g <= MAX_GENERATIONS){
-      printf("Best fitness: %.4f\n",fitness(P[0]));
-      next_generation(P);
-      sort_P_by_fitness(P);
+   double start = wall_time();
+   int first = g;
+   while ((why = check_stop(&C, &S, P->score[P->best],
+                            population_diversity(&C, P, NULL), g)) ==
+          STOP_NONE){
+      if (!C.quiet){
+         printf("Best fitness: %.4f\n",fitness(&C, P, P->best));
+      }
+      breed_population(&C, P, R);
       g++;
+      if (C.stats != NULL){
+         write_stats(&C, &T, P, g-1);
+      }
+      if (C.checkpoint != NULL && (g - 1) % C.checkpoint_every == 0 &&
+          save_checkpoint(&C, P, R, C.threads, g, &S, C.checkpoint)){
+         fprintf(stderr, "Cannot write the checkpoint %s\n", C.checkpoint);
+      }
    }
 
-   print_population(P);
+   if (C.steady_state){
+      rank_population(&C, P);
+   }
+   if (!C.quiet){
+      print_population(&C, P);
+   }
+   if (C.stats != NULL && close_stats(&T)){
+      fprintf(stderr, "Cannot write the statistics to %s\n", C.stats);
+      status = 1;
+   }
+   if (C.dump != NULL && dump_population(&C, P, C.dump)){
+      fprintf(stderr, "Cannot write the population to %s\n", C.dump);
+      status = 1;
+   }
    printf("Generations: %i\n",g);
+   printf("Stop: %s\n",stop_names[why]);
+   print_memo(&C);
+   if (C.profile){
+      print_profile(P->phase, C.p_size, g - first, wall_time() - start);
+   }
    //printf("--------------------------------\n");
-   
-   return 0;
+
+   free_population(P);
+   close_memo(&C);
+   free(R);
+   return status;
+}
+
+
+#ifndef GA_LIBRARY
+/*
+   MAIN
+   With MPI, a rank failing aborts all of them, since the others would
+   otherwise wait forever at the next reduction
+*/
+
+int main(int argc, char ** argv){
+#ifdef GA_MPI
+   int provided;
+   MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+   MPI_Comm_rank(MPI_COMM_WORLD, &mpi_rank);
+   MPI_Comm_size(MPI_COMM_WORLD, &mpi_ranks);
+   int status = run_main(argc, argv);
+   if (status && mpi_ranks > 1){
+      MPI_Abort(MPI_COMM_WORLD, status);
+   }
+   MPI_Finalize();
+   return status;
+#else
+   return run_main(argc, argv);
+#endif
 }
+#endif
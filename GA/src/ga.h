@@ -0,0 +1,127 @@
+/*
+   Library interface of GA.c, built with "make lib" (libga.a). It runs the
+   single population of the program in process, one generation at a time:
+   any number of runs can live side by side, each with its own parameters,
+   random numbers and population, and the population is read in place.
+   - ga_init picks the kernels of the process (see --kernels), NULL for the
+     best ones the processor supports. It should be called once, before the
+     first run is created, and returns 0 on success and 1 on failure
+   - ga_defaults fills the parameters with the defaults of the program
+   - ga_create draws and evaluates the first generation of a run, and
+     returns NULL (printing the reason) if the parameters are invalid or
+     there is not enough memory
+   - ga_step runs up to n more generations, stopping early when a word
+     reaches the target, and returns the number of generations it ran
+   - ga_best returns the score of the fittest word and, if "genome" is not
+     NULL, points it to its genes
+   - ga_population gives access to the population in place (see ga_view)
+   - ga_destroy frees a run (NULL is ignored)
+   Different runs can be used from different threads at once, but a run
+   must be used from one thread at a time. The pointers to a population are
+   only valid until the next ga_step or ga_destroy of its run.
+
+   Author: Gonzalo S Nido <insectopalo@gmail.com>
+*/
+
+#ifndef GA_H
+#define GA_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum { GA_CROSSOVER_ONE_POINT, GA_CROSSOVER_TWO_POINT, GA_CROSSOVER_UNIFORM };
+enum { GA_SELECTION_TRUNCATION, GA_SELECTION_TOURNAMENT,
+       GA_SELECTION_ROULETTE };
+
+/*
+   Fitness function of a run: it scores the n genomes stored "stride" words
+   apart from "genomes", 64 genes per word from the lowest bit of the first
+   one, writing them to out[0] to out[n-1]. Higher scores are fitter. The
+   roulette selection draws in proportion to the scores, so negative ones
+   are shifted up by the lowest score of the population first, which is then
+   never drawn; non-negative scores are used as they are. It is called with
+   as many genomes as possible at once, and from up to "threads" threads at
+   the same time, each with its own genomes
+*/
+typedef void (*ga_fitness)(void * user, const uint64_t * genomes, int n,
+                           int stride, float * out);
+
+/*
+   The statistics of a generation, as in the CSV of --stats: the best score,
+   the mean and variance of the scores, and the diversity and entropy of the
+   population
+*/
+typedef struct {
+   int generation;
+   float best;
+   double mean;
+   double variance;
+   double diversity;
+   double entropy;
+} ga_stats;
+
+typedef void (*ga_report)(void * user, const ga_stats * s);
+
+/*
+   The parameters of a run, named after the flags of the program (see its
+   --help); offspring is -1 for the bottleneck, crossover and selection are
+   GA_ constants, and fitness is the name of a fitness function of the
+   program. A "callback" replaces the latter, with max_score the score of a
+   perfect word (only used with the target, and infinite by default). When
+   "report" is set it gets the statistics of the first generation and of
+   every generation after it. "user" is passed to both callbacks
+*/
+typedef struct {
+   int genome_size;
+   int population;
+   int bottleneck;
+   int offspring;
+   int crossover;
+   int selection;
+   int tournament;
+   int steady_state;
+   int async;
+   int threads;
+   int memo_size;
+   double mutation_rate;
+   double target;
+   uint64_t seed;
+   const char * fitness;
+   ga_fitness callback;
+   float max_score;
+   ga_report report;
+   void * user;
+} ga_params;
+
+/*
+   A population in place: row i of the "rows" rows has its genes at
+   genomes + i * stride (the words past "words" are zero) and its score at
+   scores[i], and order[] lists the rows from the fittest to the least fit
+*/
+typedef struct {
+   const uint64_t * genomes;
+   const float * scores;
+   const int * order;
+   int rows;
+   int words;
+   int stride;
+} ga_view;
+
+typedef struct ga ga;
+
+int ga_init(const char * kernels);
+void ga_defaults(ga_params * p);
+ga * ga_create(const ga_params * p);
+int ga_step(ga * g, int n);
+float ga_best(const ga * g, const uint64_t ** genome);
+void ga_population(const ga * g, ga_view * v);
+void ga_destroy(ga * g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif